@@ -0,0 +1,132 @@
+//! Headless benchmark comparing renderer tile sizes
+//! on a text-heavy scene and a sprite-heavy scene.
+//!
+//! Run from the repository root with `cargo run --release --example tile_benchmark`.
+
+use std::{fs, sync::Arc, time::Instant};
+
+use dume::{Canvas, Context, Srgba, TextBlob, TextOptions, TextureId};
+use glam::{vec2, UVec2, Vec2};
+
+const FRAMES: u32 = 200;
+const SIZE: UVec2 = UVec2::new(1920, 1080);
+
+#[derive(Copy, Clone, Debug)]
+enum Scene {
+    Text,
+    Sprites,
+}
+
+struct SceneState {
+    text: TextBlob,
+    sprite: TextureId,
+}
+
+impl SceneState {
+    fn new(context: &Context) -> Self {
+        context
+            .add_font(include_bytes!("../../../assets/ZenAntiqueSoft-Regular.ttf").to_vec())
+            .unwrap();
+        context.set_default_font_family("Zen Antique Soft");
+
+        let mut builder = context.create_texture_set_builder();
+        builder
+            .add_texture(&fs::read("assets/image1.jpeg").unwrap(), "sprite")
+            .unwrap();
+        context.add_texture_set(builder.build(128, 8192).unwrap());
+
+        let paragraph = "The quick brown fox jumps over the lazy dog. ".repeat(400);
+        let mut text = context.create_text_blob(
+            dume::text!("@size[12][{}]", paragraph),
+            TextOptions::default(),
+        );
+        context.resize_text_blob(&mut text, SIZE.as_vec2());
+
+        Self {
+            text,
+            sprite: context.texture_for_name("sprite").unwrap(),
+        }
+    }
+
+    fn draw(&self, scene: Scene, canvas: &mut Canvas) {
+        canvas
+            .rect(Vec2::ZERO, canvas.size())
+            .solid_color(Srgba::new(u8::MAX, u8::MAX, u8::MAX, u8::MAX))
+            .fill();
+        match scene {
+            Scene::Text => {
+                canvas.draw_text(&self.text, Vec2::ZERO, 1.);
+            }
+            Scene::Sprites => {
+                for y in 0..8 {
+                    for x in 0..12 {
+                        canvas.draw_sprite(self.sprite, vec2(x as f32, y as f32) * 160., 150.);
+                    }
+                }
+            }
+        }
+    }
+}
+
+fn main() {
+    let (device, queue) = pollster::block_on(init_wgpu());
+    let device = Arc::new(device);
+    let queue = Arc::new(queue);
+
+    for scene in [Scene::Text, Scene::Sprites] {
+        for tile_size in [8, 16, 32] {
+            let context = Context::builder(Arc::clone(&device), Arc::clone(&queue))
+                .tile_size(tile_size)
+                .tile_capacity(256)
+                .build();
+            let state = SceneState::new(&context);
+            let mut canvas = context.create_canvas(SIZE, 1.);
+            let layer = context.create_layer(SIZE);
+
+            // Warm up glyph caches and pipelines.
+            state.draw(scene, &mut canvas);
+            canvas.render_to_layer(&layer);
+            device.poll(wgpu::Maintain::Wait);
+
+            let start = Instant::now();
+            for _ in 0..FRAMES {
+                state.draw(scene, &mut canvas);
+                canvas.render_to_layer(&layer);
+                device.poll(wgpu::Maintain::Wait);
+            }
+            let frame_time = start.elapsed() / FRAMES;
+
+            println!(
+                "{:?} scene, {}x{} tiles: {:.3} ms/frame",
+                scene,
+                tile_size,
+                tile_size,
+                frame_time.as_secs_f64() * 1000.
+            );
+        }
+    }
+}
+
+async fn init_wgpu() -> (wgpu::Device, wgpu::Queue) {
+    let instance = wgpu::Instance::new(wgpu::Backends::all());
+    let adapter = instance
+        .request_adapter(&wgpu::RequestAdapterOptions {
+            power_preference: wgpu::PowerPreference::HighPerformance,
+            force_fallback_adapter: false,
+            compatible_surface: None,
+        })
+        .await
+        .expect("failed to get a suitable adapter");
+
+    adapter
+        .request_device(
+            &wgpu::DeviceDescriptor {
+                label: None,
+                features: wgpu::Features::TEXTURE_ADAPTER_SPECIFIC_FORMAT_FEATURES,
+                limits: wgpu::Limits::default(),
+            },
+            None,
+        )
+        .await
+        .expect("failed to get wgpu device")
+}
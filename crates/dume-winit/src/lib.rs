@@ -91,6 +91,7 @@ impl DumeWinit {
 
                     self.main_canvas
                         .render(&frame.texture.create_view(&Default::default()));
+                    self.context.end_frame();
 
                     frame.present();
                 }
@@ -145,7 +146,10 @@ async fn init_context(window: &Window) -> (Context, wgpu::Surface) {
     let device = Arc::new(device);
     let queue = Arc::new(queue);
 
-    (Context::builder(device, queue).build(), surface)
+    (
+        Context::builder(device, queue).build_in_background(),
+        surface,
+    )
 }
 
 async fn init_wgpu(window: &Window) -> (wgpu::Device, wgpu::Queue, wgpu::Surface) {
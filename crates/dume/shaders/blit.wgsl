@@ -13,7 +13,11 @@ struct Globals {
 
 @group(0)
 @binding(0)
+#ifdef LINEAR_INTERMEDIATE
+var tex: texture_2d<f32>;
+#else
 var tex: texture_2d<u32>;
+#endif
 @group(0)
 @binding(1)
 var samp: sampler;
@@ -34,7 +38,21 @@ fn vs_main(@builtin(vertex_index) vertex_index: u32) -> VertexOutput {
     return out;
 }
 
+fn linear_to_srgb(lin: vec3<f32>) -> vec3<f32> {
+    let cutoff = lin < vec3<f32>(0.0031308);
+    let higher = 1.055 * pow(lin, vec3<f32>(1.0 / 2.4)) - 0.055;
+    let lower = lin * 12.92;
+    return mix(higher, lower, vec3<f32>(cutoff));
+}
+
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> {
+#ifdef LINEAR_INTERMEDIATE
+    // The layer stores linear colors; encode to sRGB
+    // once here for the (non-sRGB) target surface.
+    let color = textureLoad(tex, vec2<i32>(in.texcoord), 0);
+    return vec4<f32>(linear_to_srgb(color.rgb), color.a);
+#else
     return unpack4x8unorm(textureLoad(tex, vec2<i32>(in.texcoord), 0).r);
+#endif
 }
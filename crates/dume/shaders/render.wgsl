@@ -1,6 +1,21 @@
 // This file contains two kernels, one for
 // subdividing elements into tiles and one for
 // actually painting to the target texture.
+//
+// `{{NAME}}` placeholders are substituted when the pipelines
+// are created; see `Pipelines::new`.
+//
+// The paint kernel is additionally specialized on the set of
+// shapes and paint types present in a batch through `HAS_*`
+// flags (see `PaintFeatures`), so simple frames skip unused branches.
+
+// Side length of a tile in physical pixels
+let TILE_SIZE: u32 = {{TILE_SIZE}}u;
+// Maximum number of nodes that can intersect one tile
+let TILE_CAPACITY: u32 = {{TILE_CAPACITY}}u;
+// Side length of the paint kernel's workgroup. Each invocation
+// paints (TILE_SIZE / PAINT_WORKGROUP_SIZE)^2 pixels.
+let PAINT_WORKGROUP_SIZE: u32 = {{PAINT_WORKGROUP_SIZE}}u;
 
 let SHAPE_FILL_RECT: i32 = 0;
 let SHAPE_STROKE_RECT: i32 = 1;
@@ -14,10 +29,18 @@ let PAINT_TYPE_LINEAR_GRADIENT: i32 = 1;
 let PAINT_TYPE_RADIAL_GRADIENT: i32 = 2;
 let PAINT_TYPE_GLYPH: i32 = 3;
 let PAINT_TYPE_TEXTURE: i32 = 4;
+let PAINT_TYPE_SDF_GLYPH: i32 = 5;
+
+// Distance in texels from the glyph outline to the edge of a distance field.
+let SDF_SPREAD: f32 = {{SDF_SPREAD}}.0;
 
 let STROKE_CAP_ROUND: i32 = 0;
 let STROKE_CAP_SQUARE: i32 = 1;
 
+// Initial tile counter value for tiles that keep
+// their existing contents (see Batch::scroll).
+let TILE_CLEAN: u32 = 0x80000000u;
+
 struct PackedBoundingBox {
     pos: u32,
     size: u32,
@@ -31,7 +54,7 @@ struct BoundingBox {
 struct Globals {
     // Logical size of the target texture
     target_size: vec2<f32>,
-    // Number of 16x16 tiles in each dimension
+    // Number of tiles in each dimension
     tile_count: vec2<u32>,
     // Number of nodes in the input
     node_count: u32,
@@ -69,15 +92,18 @@ struct Nodes {
 
 // Stores the nodes that intersect each tile.
 //
-// Thus, the stride between tiles in the array is `64 * 4` (since
+// Thus, the stride between tiles in the array is `TILE_CAPACITY * 4` (since
 // one node index consumes 4 bytes). We assume no more than
-// 64 elements will intersect one tile. (TODO handle this case.)
+// TILE_CAPACITY elements will intersect one tile. (TODO handle this case.)
 struct TileNodes {
     tile_nodes: array<u32>,
 }
 
 // Stores atomic counters for how many
 // nodes are in each tile in `TileNodes`.
+//
+// Tiles that should not be painted start at `TILE_CLEAN`,
+// so the tile kernel treats them as full.
 struct TileNodeCounters {
     counters: array<atomic<u32>>,
 }
@@ -115,14 +141,22 @@ var<storage, read_write> tiles: TileNodes;
 var<storage, read_write> tile_counters: TileNodeCounters;
 @group(0)
 @binding(5)
+#ifdef LINEAR_INTERMEDIATE
+var target_texture: texture_storage_2d<rgba16float, read_write>;
+#else
 var target_texture: texture_storage_2d<r32uint, read_write>;
+#endif
 
 @group(0)
 @binding(6)
 var samp_linear: sampler;
+
+// Glyph atlas pages. Each page is a separate texture, so that
+// adding a page does not copy the others. Page 0 is at binding 7,
+// and the remaining pages follow the other bindings.
 @group(0)
 @binding(7) 
-var glyph_atlas: texture_2d<f32>;
+var glyph_atlas_0: texture_2d<f32>;
 
 @group(0)
 @binding(8) 
@@ -136,6 +170,53 @@ var texture_atlas: texture_2d<f32>;
 @binding(10)
 var<storage, read> scissors: Scissors;
 
+@group(0)
+@binding(11)
+var glyph_atlas_1: texture_2d<f32>;
+
+@group(0)
+@binding(12)
+var glyph_atlas_2: texture_2d<f32>;
+
+@group(0)
+@binding(13)
+var glyph_atlas_3: texture_2d<f32>;
+
+@group(0)
+@binding(14)
+var glyph_atlas_4: texture_2d<f32>;
+
+@group(0)
+@binding(15)
+var glyph_atlas_5: texture_2d<f32>;
+
+@group(0)
+@binding(16)
+var glyph_atlas_6: texture_2d<f32>;
+
+@group(0)
+@binding(17)
+var glyph_atlas_7: texture_2d<f32>;
+
+fn load_glyph_atlas(coords: vec2<i32>, page: i32) -> vec4<f32> {
+    if (page == 0) {
+        return textureLoad(glyph_atlas_0, coords, 0);
+    } else if (page == 1) {
+        return textureLoad(glyph_atlas_1, coords, 0);
+    } else if (page == 2) {
+        return textureLoad(glyph_atlas_2, coords, 0);
+    } else if (page == 3) {
+        return textureLoad(glyph_atlas_3, coords, 0);
+    } else if (page == 4) {
+        return textureLoad(glyph_atlas_4, coords, 0);
+    } else if (page == 5) {
+        return textureLoad(glyph_atlas_5, coords, 0);
+    } else if (page == 6) {
+        return textureLoad(glyph_atlas_6, coords, 0);
+    }
+    return textureLoad(glyph_atlas_7, coords, 0);
+}
+
 fn unpack_pos(pos: u32) -> vec2<f32> {
     var p = unpack2x16unorm(pos) * 65535.0;
     p = p / 4.0;
@@ -155,7 +236,7 @@ fn to_physical(pos: vec2<f32>) -> vec2<f32> {
 }
 
 // Shader that assigns an array of nodes
-// to each tile of 16x16 physical pixels.
+// to each tile of TILE_SIZE x TILE_SIZE physical pixels.
 //
 // This kernel runs for each node and determines
 // the list of tiles the node intersects. For each tile
@@ -170,7 +251,7 @@ fn unpack_bounding_box(bbox: PackedBoundingBox) -> BoundingBox {
 }
 
 fn tile_stride() -> u32 {
-    return u32(64);
+    return TILE_CAPACITY;
 }
 
 fn tile_index(tile_pos: vec2<u32>) -> u32 {
@@ -180,11 +261,11 @@ fn tile_index(tile_pos: vec2<u32>) -> u32 {
 fn to_tile_pos(pos: vec2<f32>) -> vec2<u32> {
     let pos = to_physical(pos);
     let pos = clamp(pos, vec2<f32>(0.0), globals.target_size * globals.scale_factor);
-    return vec2<u32>(pos / 16.0);
+    return vec2<u32>(pos / f32(TILE_SIZE));
 }
 
 // Shader that assigns an array of nodes
-// to each tile of 16x16 physical pixels.
+// to each tile of TILE_SIZE x TILE_SIZE physical pixels.
 //
 // This kernel runs for each node (excluding fills) and determines
 // the list of tiles the node intersects. For each tile
@@ -206,7 +287,7 @@ fn spread_tiles(node_index: u32, min: vec2<u32>, max: vec2<u32>) {
         let tile_index = tile_index(vec2<u32>(x, y));
         let ip = &tile_counters.counters[x + y * globals.tile_count.x];
         let i = atomicAdd(ip, u32(1));
-        if (i >= u32(64)) {
+        if (i >= TILE_CAPACITY) {
             // The tile's buffer is full. For now, we'll
             // just skip the excess nodes - in the future we might
             // want some sort of overflow mechanism.
@@ -259,7 +340,7 @@ fn tile_fill_node(node: Node, node_index: u32) {
 }
 
 @compute
-@workgroup_size(256)
+@workgroup_size({{TILE_WORKGROUP_SIZE}})
 fn tile_kernel(
     @builtin(global_invocation_id) global_id: vec3<u32>,
 ) {
@@ -284,10 +365,10 @@ fn tile_kernel(
 
 // The array of nodes loaded into private memory to reduce
 // access times
-var<private> local_nodes: array<u32, 64>;
+var<private> local_nodes: array<u32, {{TILE_CAPACITY}}>;
 
 @compute
-@workgroup_size(16, 16)
+@workgroup_size({{SORT_WORKGROUP_SIZE}}, {{SORT_WORKGROUP_SIZE}})
 fn sort_kernel(@builtin(global_invocation_id) global_id: vec3<u32>) {
     let tile_id = global_id.xy;
 
@@ -295,9 +376,14 @@ fn sort_kernel(@builtin(global_invocation_id) global_id: vec3<u32>) {
         return;
     }
 
+    let counter = tile_counters.counters[tile_id.x + tile_id.y * globals.tile_count.x];
+    if (counter >= TILE_CLEAN) {
+        return;
+    }
+
     // Copy the node list from global memory into private memory
-    var num_nodes = i32(tile_counters.counters[tile_id.x + tile_id.y * globals.tile_count.x]);
-    num_nodes = min(num_nodes, 64);
+    var num_nodes = i32(counter);
+    num_nodes = min(num_nodes, i32(TILE_CAPACITY));
     let base_index = i32(tile_index(tile_id));
     var i = base_index;
     loop {
@@ -393,6 +479,29 @@ fn lch_to_oklab(lch: vec3<f32>) -> vec3<f32> {
     return vec3<f32>(lch.x, lch.y * cos(lch.z), lch.y * sin(lch.z));
 }
 
+// Loads a pixel from the target texture as linear RGB.
+fn load_target(pixel: vec2<i32>) -> vec3<f32> {
+#ifdef LINEAR_INTERMEDIATE
+    return textureLoad(target_texture, pixel).rgb;
+#else
+    let color = unpack4x8unorm(textureLoad(target_texture, pixel).r).rgb;
+    return srgb_to_linear(color);
+#endif
+}
+
+// Stores a linear RGB pixel onto the target texture. Note that
+// for packed sRGB targets, we have to do the linear => sRGB
+// conversion ourselves.
+fn store_target(pixel: vec2<i32>, color: vec3<f32>) {
+    let color = clamp(color, vec3<f32>(0.0), vec3<f32>(1.0));
+#ifdef LINEAR_INTERMEDIATE
+    textureStore(target_texture, pixel, vec4<f32>(color, 1.0));
+#else
+    let result = linear_to_srgb(color);
+    textureStore(target_texture, pixel, vec4<u32>(pack4x8unorm(vec4<f32>(result, 1.0))));
+#endif
+}
+
 fn unpack_color(color: u32) -> vec4<f32> {
     let color = unpack4x8unorm(color);
     let srgb = srgb_to_linear(color.rgb);
@@ -432,23 +541,72 @@ fn radial_gradient(pos: vec2<f32>, center: vec2<f32>, radius: f32, color_a: vec4
     return interpolate_colors(color_a, color_b, t);
 }
 
+#ifdef HAS_SDF_GLYPH
+fn load_sdf(offset: vec2<u32>, page: i32, texcoords: vec2<u32>) -> f32 {
+    return load_glyph_atlas(vec2<i32>(offset + texcoords), page).r;
+}
+
+// Colors a pixel of a distance field glyph. The atlas is not filterable,
+// so the field is interpolated manually.
+fn sdf_glyph_color(node: Node, pixel_pos: vec2<f32>) -> vec4<f32> {
+    let offset = unpack_upos(node.gradient_point_a);
+    let size = unpack_upos(node.gradient_point_b);
+    let color = unpack_color(node.color_a);
+    let page = i32(points.list[node.color_b]);
+    let texels_per_pixel = bitcast<f32>(points.list[node.color_b + u32(1)]);
+    let origin = vec2<f32>(
+        bitcast<f32>(points.list[node.color_b + u32(2)]),
+        bitcast<f32>(points.list[node.color_b + u32(3)]),
+    );
+
+    let max_texcoords = vec2<f32>(size - vec2<u32>(u32(1)));
+    let texcoords = clamp(
+        (pixel_pos + 0.5 - origin) * texels_per_pixel - 0.5,
+        vec2<f32>(0.0),
+        max_texcoords,
+    );
+    let a = vec2<u32>(floor(texcoords));
+    let b = vec2<u32>(min(vec2<f32>(a + vec2<u32>(u32(1))), max_texcoords));
+    let t = fract(texcoords);
+
+    let top = mix(load_sdf(offset, page, a), load_sdf(offset, page, vec2<u32>(b.x, a.y)), t.x);
+    let bottom = mix(load_sdf(offset, page, vec2<u32>(a.x, b.y)), load_sdf(offset, page, b), t.x);
+    let value = mix(top, bottom, t.y);
+
+    // Signed distance to the outline in pixels, positive inside.
+    let distance = (value - 0.5) * 2.0 * SDF_SPREAD / texels_per_pixel;
+    let coverage = clamp(distance + 0.5, 0.0, 1.0);
+    return vec4<f32>(color.rgb, color.a * coverage);
+}
+#endif
+
 fn node_color(node: Node, pixel_pos: vec2<f32>, node_index: i32) -> vec4<f32> {
     let paint = node.paint_type;
+#ifdef HAS_SOLID
     if (paint == PAINT_TYPE_SOLID) {
         return unpack_color(node.color_a);
-    } else if (paint == PAINT_TYPE_LINEAR_GRADIENT) {
+    }
+#endif
+#ifdef HAS_LINEAR_GRADIENT
+    if (paint == PAINT_TYPE_LINEAR_GRADIENT) {
         let point_a = to_physical(unpack_pos(node.gradient_point_a));
         let point_b = to_physical(unpack_pos(node.gradient_point_b));
         let color_a = unpack_color(node.color_a);
         let color_b = unpack_color(node.color_b);
         return linear_gradient(pixel_pos, point_a, point_b, color_a, color_b);
-    } else if (paint == PAINT_TYPE_RADIAL_GRADIENT) {
+    }
+#endif
+#ifdef HAS_RADIAL_GRADIENT
+    if (paint == PAINT_TYPE_RADIAL_GRADIENT) {
         let center = to_physical(unpack_pos(node.gradient_point_a));
         let radius = to_physical(unpack_pos(node.gradient_point_b)).x;
         let color_a = unpack_color(node.color_a);
         let color_b = unpack_color(node.color_b);
         return radial_gradient(pixel_pos, center, radius, color_a, color_b); 
-    } else if (paint == PAINT_TYPE_TEXTURE) {
+    }
+#endif
+#ifdef HAS_TEXTURE
+    if (paint == PAINT_TYPE_TEXTURE) {
         let offset = unpack_upos(node.gradient_point_a);
         let origin = to_physical(unpack_pos(node.gradient_point_b));
         let scale = bitcast<f32>(node.color_a) / globals.scale_factor;
@@ -470,13 +628,19 @@ fn node_color(node: Node, pixel_pos: vec2<f32>, node_index: i32) -> vec4<f32> {
         let texcoords = (vec2<f32>(offset) + texcoords) / vec2<f32>(texsize);
 
         return textureSampleLevel(texture_atlas, samp_linear, texcoords, 0.0);
-    } else {
-        // Should never happen.
-        return vec4<f32>(1.0, 0.0, 0.0, 1.0);
     }
+#endif
+#ifdef HAS_SDF_GLYPH
+    if (paint == PAINT_TYPE_SDF_GLYPH) {
+        return sdf_glyph_color(node, pixel_pos);
+    }
+#endif
+
+    // Should never happen.
+    return vec4<f32>(1.0, 0.0, 0.0, 1.0);
 }
 
-var<workgroup> nodes_in_tile: array<Node, 64>;
+var<workgroup> nodes_in_tile: array<Node, {{TILE_CAPACITY}}>;
 var<private> node_index: i32;
 var<private> num_nodes: i32;
 
@@ -677,18 +841,29 @@ fn fill_coverage(node: Node, pixel_pos: vec2<f32>) -> f32 {
 }
 
 fn node_coverage(node: Node, pixel_pos: vec2<f32>) -> f32 {
+#ifdef HAS_RECT
     if (node.shape == SHAPE_FILL_RECT || node.shape == SHAPE_STROKE_RECT) {
         return rect_coverage(node, pixel_pos);
-    } else if (node.shape == SHAPE_FILL_CIRCLE || node.shape == SHAPE_STROKE_CIRCLE) {
+    }
+#endif
+#ifdef HAS_CIRCLE
+    if (node.shape == SHAPE_FILL_CIRCLE || node.shape == SHAPE_STROKE_CIRCLE) {
         return circle_coverage(node, pixel_pos);
-    } else if (node.shape == SHAPE_STROKE_PATH) {
+    }
+#endif
+#ifdef HAS_STROKE_PATH
+    if (node.shape == SHAPE_STROKE_PATH) {
         return stroke_coverage(node, pixel_pos);
-    } else if (node.shape == SHAPE_FILL_PATH) {
+    }
+#endif
+#ifdef HAS_FILL_PATH
+    if (node.shape == SHAPE_FILL_PATH) {
         return fill_coverage(node, pixel_pos);
-    } else {
-        // Should never happen
-        return 1.0;
     }
+#endif
+
+    // Should never happen
+    return 1.0;
 }
 
 fn scissor_coverage_factor(node: Node, pixel_pos: vec2<f32>) -> f32 {
@@ -707,38 +882,12 @@ fn scissor_coverage_factor(node: Node, pixel_pos: vec2<f32>) -> f32 {
     return clamp(1.0 - dist, 0.0, 1.0);
 }
 
-@compute
-@workgroup_size(16, 16)
-fn paint_kernel(
-    @builtin(local_invocation_id) local_id: vec3<u32>,
-    @builtin(workgroup_id) tile_id: vec3<u32>,
-) {
-    let pixel = vec2<i32>(tile_id.xy) * vec2<i32>(16) + vec2<i32>(local_id.xy);
+// Paints a single pixel using the nodes in `nodes_in_tile`.
+fn paint_pixel(pixel: vec2<i32>) {
     let pixel_pos = vec2<f32>(pixel);
-    
-    var color = unpack4x8unorm(textureLoad(target_texture, pixel).r).rgb;
-    color = srgb_to_linear(color);
-
-    let base_index = i32(tile_index(tile_id.xy));
-    num_nodes = i32(tile_counters.counters[tile_id.x + tile_id.y * globals.tile_count.x]);
-    num_nodes = min(num_nodes, 64);
+    var color = load_target(pixel);
     node_index = 0;
 
-    // Copy nodes into workgroup memory
-    if (local_id.x == u32(0)) {
-        var i = 0;
-        loop {
-            if (i >= num_nodes) {
-                break;
-            }
-            let node_index = tiles.tile_nodes[base_index + i];
-            nodes_in_tile[i] = nodes.nodes[node_index];
-            i = i + 1;
-        }
-    }
-
-    workgroupBarrier();
-
     loop {
         if (!has_next_node()) {
             break;
@@ -746,6 +895,7 @@ fn paint_kernel(
         let node: Node = take_next_node();
 
         var coverage = 0.0;
+#ifdef HAS_STROKE_PATH
         if (node.shape == SHAPE_STROKE_PATH) {
             // Consume all segments in the same path (each is its own node)
             // then choose the segment with the highest coverage.
@@ -765,27 +915,88 @@ fn paint_kernel(
         } else {
             coverage = node_coverage(node, pixel_pos);
         }
+#else
+        coverage = node_coverage(node, pixel_pos);
+#endif
 
+#ifdef HAS_SCISSOR
         coverage = coverage * scissor_coverage_factor(node, pixel_pos);
+#endif
         
+#ifdef HAS_GLYPH
         if (node.paint_type == PAINT_TYPE_GLYPH) {
             // Special case for subpixel blending.
             let offset = unpack_upos(node.gradient_point_a);
             let origin = unpack_upos(node.gradient_point_b);
             let text_color = unpack_color(node.color_a);
+            let page = i32(node.color_b);
         
             let texcoords = offset + (vec2<u32>(pixel_pos) - origin);
-            let mask = textureLoad(glyph_atlas, vec2<i32>(texcoords), 0).rgb;
+#ifdef GRAYSCALE_GLYPHS
+            let mask = vec3<f32>(load_glyph_atlas(vec2<i32>(texcoords), page).r);
+#else
+            let mask = load_glyph_atlas(vec2<i32>(texcoords), page).rgb;
+#endif
             color = mix(color, text_color.rgb * mask + (1.0 - text_color.a * mask) * color, coverage);
-        } else {
-            let node_color = node_color(node, pixel_pos, get_node_index() - 1);
-            color = mix(color, node_color.rgb, coverage * node_color.a);
+            continue;
         }
+#endif
+
+        let node_color = node_color(node, pixel_pos, get_node_index() - 1);
+        color = mix(color, node_color.rgb, coverage * node_color.a);
     }
 
-    // Store onto the target texture. Note that we have
-    // to do the linear => sRGB conversion ourselves.
-    let color = clamp(color, vec3<f32>(0.0), vec3<f32>(1.0));
-    let result = linear_to_srgb(color);
-    textureStore(target_texture, pixel, vec4<u32>(pack4x8unorm(vec4<f32>(result, 1.0))));
+    store_target(pixel, color);
+}
+
+@compute
+@workgroup_size({{PAINT_WORKGROUP_SIZE}}, {{PAINT_WORKGROUP_SIZE}})
+fn paint_kernel(
+    @builtin(local_invocation_id) local_id: vec3<u32>,
+    @builtin(workgroup_id) tile_id: vec3<u32>,
+) {
+    let counter = tile_counters.counters[tile_id.x + tile_id.y * globals.tile_count.x];
+    if (counter >= TILE_CLEAN) {
+        // Tile keeps its existing contents.
+        return;
+    }
+
+    let base_index = i32(tile_index(tile_id.xy));
+    num_nodes = i32(counter);
+    num_nodes = min(num_nodes, i32(TILE_CAPACITY));
+
+    // Copy nodes into workgroup memory, spread across
+    // the first row of invocations
+    if (local_id.y == u32(0)) {
+        var i = i32(local_id.x);
+        loop {
+            if (i >= num_nodes) {
+                break;
+            }
+            let node_index = tiles.tile_nodes[base_index + i];
+            nodes_in_tile[i] = nodes.nodes[node_index];
+            i = i + i32(PAINT_WORKGROUP_SIZE);
+        }
+    }
+
+    workgroupBarrier();
+
+    // Tiles larger than the workgroup are covered by
+    // having each invocation paint a strided grid of pixels.
+    let tile_origin = vec2<i32>(tile_id.xy * TILE_SIZE);
+    var y = local_id.y;
+    loop {
+        if (y >= TILE_SIZE) {
+            break;
+        }
+        var x = local_id.x;
+        loop {
+            if (x >= TILE_SIZE) {
+                break;
+            }
+            paint_pixel(tile_origin + vec2<i32>(vec2<u32>(x, y)));
+            x = x + PAINT_WORKGROUP_SIZE;
+        }
+        y = y + PAINT_WORKGROUP_SIZE;
+    }
 }
@@ -4,6 +4,7 @@ use glam::UVec2;
 
 pub mod dynamic;
 pub mod r#static;
+mod upload;
 
 pub use dynamic::DynamicTextureAtlas;
 pub use r#static::{StaticTextureAtlas, StaticTextureAtlasBuilder};
@@ -13,6 +14,9 @@ pub use r#static::{StaticTextureAtlas, StaticTextureAtlasBuilder};
 /// All lengths are in physical pixels.
 #[derive(Copy, Clone, Debug, PartialEq, Eq, Hash)]
 pub struct AtlasEntry {
+    /// Index of the page (separate texture) containing the texture.
+    /// Always zero for static atlases.
+    pub page: u32,
     /// Offset of the start of the texture from the atlas origin
     pub pos: UVec2,
     /// Size of the texture
@@ -1,42 +1,94 @@
-use std::{iter, num::NonZeroU32, sync::Arc};
+use std::{
+    iter,
+    num::NonZeroU32,
+    sync::{mpsc, Arc},
+};
 
 use ahash::AHashMap;
 use glam::{uvec2, vec2, Vec2};
 use guillotiere::{Allocation, AtlasAllocator, Size};
 
-use super::{AtlasEntry, TextureKey};
+use super::{upload::TextureUploads, AtlasEntry, TextureKey};
 
-const STARTING_DIM: u32 = 2048;
+/// Side length of each atlas page.
+const PAGE_DIM: u32 = 2048;
+
+/// Maximum number of pages in an atlas. Each page is bound to
+/// its own shader binding, so this is fixed when shaders are built.
+pub const MAX_PAGES: usize = 8;
+
+/// Occupancy below which [`DynamicTextureAtlas::compact_step`] starts
+/// releasing pages. Well below what a page added to a full atlas
+/// leaves, so that adding a page does not start a compaction.
+const COMPACT_BELOW_OCCUPANCY: f32 = 0.25;
+/// Number of calls to [`DynamicTextureAtlas::compact_step`] to skip
+/// after the atlas turned out to be too fragmented to compact.
+const COMPACTION_COOLDOWN: u32 = 600;
 
 /// A dynamic texture atlas that supports adding and removing
 /// textures on demand. Space from deallocated textures can be reused.
 ///
+/// Textures are packed into fixed-size pages, each backed by its
+/// own texture. When all pages are full, a new page is added
+/// without touching existing pages, up to [`MAX_PAGES`].
+///
 /// A padding of two pixels is inserted between stiched textures
 /// to avoid bleeding.
+///
+/// Texture data is staged on insertion and only copied to the GPU
+/// in [`flush_uploads`](Self::flush_uploads), so that the textures
+/// inserted during a frame are uploaded together.
+///
+/// Removing textures fragments the free space, and pages are
+/// never released on their own. Call [`compact_step`](Self::compact_step)
+/// at points where no atlas positions are held outside the atlas to
+/// gradually move textures off sparse pages.
 pub struct DynamicTextureAtlas {
     descriptor: wgpu::TextureDescriptor<'static>,
-    texture: wgpu::Texture,
-    texture_view: wgpu::TextureView,
+    packer: Packer,
+    /// Texture of each page in `packer`.
+    pages: Vec<Page>,
+    /// Number of pages created up front, which are never released.
+    min_pages: usize,
 
-    allocator: AtlasAllocator,
-    entries: AHashMap<TextureKey, Allocation>,
+    entries: AHashMap<TextureKey, Entry>,
+    /// Total area of all allocations, including padding.
+    used_area: u64,
+    /// Whether `compact_step` is emptying the last page.
+    compacting: bool,
+    compaction_cooldown: u32,
 
     device: Arc<wgpu::Device>,
     queue: Arc<wgpu::Queue>,
 }
 
+struct Page {
+    texture: wgpu::Texture,
+    texture_view: wgpu::TextureView,
+    uploads: TextureUploads,
+}
+
+#[derive(Copy, Clone, Debug)]
+struct Entry {
+    page: u32,
+    allocation: Allocation,
+}
+
 impl DynamicTextureAtlas {
+    /// Creates an atlas with `initial_pages` pages.
     pub fn new(
         device: Arc<wgpu::Device>,
         queue: Arc<wgpu::Queue>,
         format: wgpu::TextureFormat,
         label: &'static str,
+        initial_pages: u32,
     ) -> Self {
+        let min_pages = (initial_pages as usize).clamp(1, MAX_PAGES);
         let descriptor = wgpu::TextureDescriptor {
             label: Some(label),
             size: wgpu::Extent3d {
-                width: STARTING_DIM,
-                height: STARTING_DIM,
+                width: PAGE_DIM,
+                height: PAGE_DIM,
                 depth_or_array_layers: 1,
             },
             mip_level_count: 1,
@@ -47,56 +99,162 @@ impl DynamicTextureAtlas {
                 | wgpu::TextureUsages::TEXTURE_BINDING
                 | wgpu::TextureUsages::COPY_SRC,
         };
-        let texture = device.create_texture(&descriptor);
 
-        Self {
+        let mut atlas = Self {
             descriptor,
-            texture_view: texture.create_view(&Default::default()),
-            texture,
+            packer: Packer::new(min_pages),
+            pages: Vec::with_capacity(MAX_PAGES),
+            min_pages,
 
-            allocator: AtlasAllocator::new(Size::new(STARTING_DIM as i32, STARTING_DIM as i32)),
             entries: AHashMap::new(),
+            used_area: 0,
+            compacting: false,
+            compaction_cooldown: 0,
 
             device,
             queue,
-        }
+        };
+        atlas.add_page_textures();
+        atlas
     }
 
     /// Inserts a new texture, returning its ID.
     ///
-    /// The atlas is grown if necessary.
-    pub fn insert(&mut self, texture: &[u8], width: u32, height: u32) -> TextureKey {
+    /// A page is added if necessary. Returns `None` if the texture
+    /// is larger than a page or all [`MAX_PAGES`] pages are full.
+    pub fn insert(&mut self, texture: &[u8], width: u32, height: u32) -> Option<TextureKey> {
         assert_ne!(width, 0, "width cannot be zero");
         assert_ne!(height, 0, "height cannot be zero");
-        let key = TextureKey::new();
-        let size = Size::new(width as i32 + 2, height as i32 + 2);
-        let allocation = match self.allocator.allocate(size) {
-            Some(a) => a,
-            None => {
-                self.grow(
-                    width + self.descriptor.size.width + 2,
-                    height + self.descriptor.size.height + 2,
-                );
-                self.allocator.allocate(size).expect("did not grow")
-            }
-        };
+        let entry = self.packer.allocate(padded_size(width, height)?)?;
+        self.add_page_textures();
 
-        self.write_texture(texture, width, height, allocation);
+        self.write_texture(texture, width, height, entry);
 
-        self.entries.insert(key, allocation);
-        key
+        let key = TextureKey::new();
+        self.used_area += allocation_area(&entry.allocation);
+        self.entries.insert(key, entry);
+        Some(key)
+    }
+
+    /// Returns whether a texture of the given size fits in a page.
+    pub fn fits_in_page(width: u32, height: u32) -> bool {
+        padded_size(width, height).is_some()
     }
 
     /// Deallocates a texture, allowing its space to be reused.
     pub fn remove(&mut self, key: TextureKey) {
-        if let Some(alloc) = self.entries.get(&key) {
-            self.allocator.deallocate(alloc.id);
+        if let Some(entry) = self.entries.remove(&key) {
+            self.packer.deallocate(&entry);
+            self.used_area -= allocation_area(&entry.allocation);
+        }
+    }
+
+    /// Gets the fraction of the area of all pages occupied by textures.
+    pub fn occupancy(&self) -> f32 {
+        self.used_area as f32 / (self.pages.len() as f32 * page_area() as f32)
+    }
+
+    /// Moves up to `max_moves` textures from the last page into
+    /// earlier pages, releasing the last page once it is empty.
+    /// Returns whether any texture moved.
+    ///
+    /// Compaction starts once the atlas is less than a quarter occupied
+    /// and continues over later calls until a page is released. If the
+    /// remaining pages are too fragmented to take a texture, it is
+    /// abandoned and not retried for a while.
+    ///
+    /// Keys remain valid, but positions returned by [`get`](Self::get)
+    /// and [`texcoords`](Self::texcoords) before a call that returns `true`
+    /// are invalidated, so call this only while no such positions are in use.
+    pub fn compact_step(&mut self, max_moves: usize) -> bool {
+        if self.compaction_cooldown > 0 {
+            self.compaction_cooldown -= 1;
+            return false;
+        }
+        if !self.compacting {
+            if self.pages.len() <= self.min_pages || self.occupancy() >= COMPACT_BELOW_OCCUPANCY {
+                return false;
+            }
+            log::info!("Compacting atlas with {} pages", self.pages.len());
+            self.compacting = true;
+        }
+
+        // Textures being moved may still have pending uploads.
+        self.flush_uploads();
+
+        let last_page = self.pages.len() - 1;
+        let moving: Vec<(TextureKey, Entry)> = self
+            .entries
+            .iter()
+            .filter(|(_, entry)| entry.page as usize == last_page)
+            .map(|(key, entry)| (*key, *entry))
+            .take(max_moves)
+            .collect();
+
+        let mut moves = Vec::with_capacity(moving.len());
+        for (key, old) in moving {
+            let size = old.allocation.rectangle.size();
+            match self.packer.allocate_before(last_page, size) {
+                Some(new) => {
+                    self.packer.deallocate(&old);
+                    self.entries.insert(key, new);
+                    moves.push((old, new));
+                }
+                None => {
+                    log::info!("Atlas too fragmented to compact");
+                    self.compacting = false;
+                    self.compaction_cooldown = COMPACTION_COOLDOWN;
+                    break;
+                }
+            }
+        }
+        self.copy_moved(&moves);
+
+        if self.entries.values().all(|e| e.page as usize != last_page) {
+            self.packer.pages.pop();
+            self.pages.pop();
+            self.compacting = false;
+            log::info!("Atlas released page {}", last_page + 1);
+        }
+
+        !moves.is_empty()
+    }
+
+    /// Copies moved textures to their new positions. Textures only
+    /// move off the last page, so source and destination are always
+    /// different textures.
+    fn copy_moved(&self, moves: &[(Entry, Entry)]) {
+        if moves.is_empty() {
+            return;
+        }
+
+        let mut encoder = self.device.create_command_encoder(&Default::default());
+        for (old, new) in moves {
+            encoder.copy_texture_to_texture(
+                self.image_copy(old),
+                self.image_copy(new),
+                allocation_extent(old),
+            );
+        }
+        self.queue.submit(iter::once(encoder.finish()));
+    }
+
+    fn image_copy(&self, entry: &Entry) -> wgpu::ImageCopyTexture {
+        wgpu::ImageCopyTexture {
+            texture: &self.pages[entry.page as usize].texture,
+            mip_level: 0,
+            origin: wgpu::Origin3d {
+                x: entry.allocation.rectangle.min.x as u32,
+                y: entry.allocation.rectangle.min.y as u32,
+                z: 0,
+            },
+            aspect: wgpu::TextureAspect::All,
         }
     }
 
     /// Gets a texture's placement in the texture atlas.
     pub fn get(&self, key: TextureKey) -> AtlasEntry {
-        let allocation = self.entries[&key];
+        let Entry { page, allocation } = self.entries[&key];
         let pos = uvec2(
             (allocation.rectangle.min.x + 1) as u32,
             (allocation.rectangle.min.y + 1) as u32,
@@ -105,24 +263,24 @@ impl DynamicTextureAtlas {
             (allocation.rectangle.max.x - allocation.rectangle.min.x - 2) as u32,
             (allocation.rectangle.max.y - allocation.rectangle.min.y - 2) as u32,
         );
-        AtlasEntry { pos, size }
+        AtlasEntry { page, pos, size }
     }
 
-    /// Gets the atlas texture.
-    pub fn texture(&self) -> &wgpu::Texture {
-        &self.texture
+    /// Gets the number of pages.
+    pub fn page_count(&self) -> usize {
+        self.pages.len()
     }
 
-    pub fn texture_view(&self) -> &wgpu::TextureView {
-        &self.texture_view
+    /// Gets a view of the texture backing a page, or `None`
+    /// if the page does not exist.
+    pub fn page_view(&self, page: usize) -> Option<&wgpu::TextureView> {
+        self.pages.get(page).map(|page| &page.texture_view)
     }
 
+    /// Gets the texture coordinates of a texture within its page.
     pub fn texcoords(&self, key: TextureKey) -> [Vec2; 4] {
         let placement = self.get(key);
-        let size = vec2(
-            self.descriptor.size.width as f32,
-            self.descriptor.size.height as f32,
-        );
+        let size = vec2(PAGE_DIM as f32, PAGE_DIM as f32);
         let start = placement.pos.as_vec2() / size;
         let size = placement.size.as_vec2() / size;
         [
@@ -133,78 +291,240 @@ impl DynamicTextureAtlas {
         ]
     }
 
-    fn write_texture(&mut self, texture: &[u8], width: u32, height: u32, allocation: Allocation) {
-        self.queue.write_texture(
+    /// Reads textures back from the GPU, returning the tightly packed
+    /// data of each texture in the order of `keys`.
+    ///
+    /// This blocks until the GPU has copied each page holding one of
+    /// the textures, so it is meant for infrequent uses such as saving
+    /// the atlas contents.
+    pub fn read_textures(
+        &mut self,
+        keys: &[TextureKey],
+    ) -> Result<Vec<Vec<u8>>, wgpu::BufferAsyncError> {
+        self.flush_uploads();
+
+        let block_size = self.descriptor.format.describe().block_size as usize;
+        let row_len = PAGE_DIM as usize * block_size;
+        let placements: Vec<AtlasEntry> = keys.iter().map(|&key| self.get(key)).collect();
+        let mut textures = vec![Vec::new(); keys.len()];
+
+        // Pages are read one at a time to bound the staging memory.
+        for page in 0..self.pages.len() {
+            if placements.iter().all(|p| p.page as usize != page) {
+                continue;
+            }
+            let data = self.read_page(page)?;
+            for (placement, texture) in placements.iter().zip(&mut textures) {
+                if placement.page as usize != page {
+                    continue;
+                }
+                let width = placement.size.x as usize * block_size;
+                texture.reserve(width * placement.size.y as usize);
+                for y in placement.pos.y..placement.pos.y + placement.size.y {
+                    let start = y as usize * row_len + placement.pos.x as usize * block_size;
+                    texture.extend_from_slice(&data[start..start + width]);
+                }
+            }
+        }
+        Ok(textures)
+    }
+
+    /// Copies a page into CPU memory, waiting for the copy to complete.
+    fn read_page(&self, page: usize) -> Result<Vec<u8>, wgpu::BufferAsyncError> {
+        // A page row is always a multiple of the copy alignment.
+        let bytes_per_row = PAGE_DIM * self.descriptor.format.describe().block_size as u32;
+        let buffer = self.device.create_buffer(&wgpu::BufferDescriptor {
+            label: Some("atlas_readback"),
+            size: bytes_per_row as u64 * PAGE_DIM as u64,
+            usage: wgpu::BufferUsages::COPY_DST | wgpu::BufferUsages::MAP_READ,
+            mapped_at_creation: false,
+        });
+
+        let mut encoder = self.device.create_command_encoder(&Default::default());
+        encoder.copy_texture_to_buffer(
             wgpu::ImageCopyTexture {
-                texture: &self.texture,
+                texture: &self.pages[page].texture,
                 mip_level: 0,
-                origin: wgpu::Origin3d {
-                    x: allocation.rectangle.min.x as u32 + 1,
-                    y: allocation.rectangle.min.y as u32 + 1,
-                    z: 0,
-                },
+                origin: wgpu::Origin3d::ZERO,
                 aspect: wgpu::TextureAspect::All,
             },
-            texture,
-            wgpu::ImageDataLayout {
-                offset: 0,
-                bytes_per_row: Some(
-                    NonZeroU32::new(self.descriptor.format.describe().block_size as u32 * width)
-                        .expect("width is zero"),
-                ),
-                rows_per_image: Some(NonZeroU32::new(height).expect("height is zero")),
+            wgpu::ImageCopyBuffer {
+                buffer: &buffer,
+                layout: wgpu::ImageDataLayout {
+                    offset: 0,
+                    bytes_per_row: NonZeroU32::new(bytes_per_row),
+                    rows_per_image: None,
+                },
             },
-            wgpu::Extent3d {
-                width,
-                height,
-                depth_or_array_layers: 1,
+            self.descriptor.size,
+        );
+        self.queue.submit(iter::once(encoder.finish()));
+
+        let slice = buffer.slice(..);
+        let (sender, receiver) = mpsc::channel();
+        slice.map_async(wgpu::MapMode::Read, move |result| {
+            let _ = sender.send(result);
+        });
+        self.device.poll(wgpu::Maintain::Wait);
+        receiver.recv().unwrap_or(Err(wgpu::BufferAsyncError))?;
+
+        let data = slice.get_mapped_range().to_vec();
+        buffer.unmap();
+        Ok(data)
+    }
+
+    /// Copies the textures inserted since the last flush to the GPU.
+    ///
+    /// The copies are submitted immediately rather than recorded into
+    /// a caller's encoder, so that they are ordered before the copies
+    /// made by [`compact_step`](Self::compact_step).
+    pub fn flush_uploads(&mut self) {
+        if self.pages.iter().all(|page| page.uploads.is_empty()) {
+            return;
+        }
+
+        let mut encoder = self.device.create_command_encoder(&Default::default());
+        for page in &mut self.pages {
+            page.uploads
+                .record(&self.device, &mut encoder, &page.texture);
+        }
+        self.queue.submit(iter::once(encoder.finish()));
+    }
+
+    fn write_texture(&mut self, texture: &[u8], width: u32, height: u32, entry: Entry) {
+        self.pages[entry.page as usize].uploads.push(
+            texture,
+            uvec2(width, height),
+            wgpu::Origin3d {
+                x: entry.allocation.rectangle.min.x as u32 + 1,
+                y: entry.allocation.rectangle.min.y as u32 + 1,
+                z: 0,
             },
         );
     }
 
-    fn grow(&mut self, min_width: u32, min_height: u32) {
-        let new_width = min_width.next_power_of_two();
-        let new_height = min_height.next_power_of_two();
+    /// Creates textures for pages added by the packer.
+    fn add_page_textures(&mut self) {
+        while self.pages.len() < self.packer.pages.len() {
+            let texture = self.device.create_texture(&self.descriptor);
+            self.pages.push(Page {
+                texture_view: texture.create_view(&Default::default()),
+                texture,
+                uploads: TextureUploads::new(self.descriptor.format),
+            });
+            log::info!("Atlas adding page {}", self.pages.len());
+        }
+    }
+}
+
+/// Space allocation within the atlas pages, kept apart
+/// from the page textures.
+struct Packer {
+    pages: Vec<AtlasAllocator>,
+}
+
+impl Packer {
+    fn new(pages: usize) -> Self {
+        Self {
+            pages: (0..pages).map(|_| new_page()).collect(),
+        }
+    }
+
+    /// Allocates space in the first page with room,
+    /// adding a page if there is none and fewer than
+    /// [`MAX_PAGES`] pages exist.
+    fn allocate(&mut self, size: Size) -> Option<Entry> {
+        if let Some(entry) = self.allocate_before(self.pages.len(), size) {
+            return Some(entry);
+        }
+        if self.pages.len() == MAX_PAGES {
+            return None;
+        }
+        self.pages.push(new_page());
+        self.allocate_before(self.pages.len(), size)
+    }
+
+    /// Allocates space in the first page with room among the first `pages` pages.
+    fn allocate_before(&mut self, pages: usize, size: Size) -> Option<Entry> {
+        self.pages[..pages]
+            .iter_mut()
+            .enumerate()
+            .find_map(|(i, page)| {
+                page.allocate(size).map(|allocation| Entry {
+                    page: i as u32,
+                    allocation,
+                })
+            })
+    }
 
-        log::info!("Atlas growing to {}x{}", new_width, new_height);
+    fn deallocate(&mut self, entry: &Entry) {
+        self.pages[entry.page as usize].deallocate(entry.allocation.id);
+    }
+}
 
-        self.allocator
-            .grow(Size::new(new_width as i32, new_height as i32));
+fn new_page() -> AtlasAllocator {
+    AtlasAllocator::new(Size::new(PAGE_DIM as i32, PAGE_DIM as i32))
+}
 
-        let wgpu::Extent3d {
-            width: old_width,
-            height: old_height,
-            ..
-        } = self.descriptor.size;
+/// Size of the allocation for a texture, including padding,
+/// or `None` if it does not fit in a page.
+fn padded_size(width: u32, height: u32) -> Option<Size> {
+    let width = width.checked_add(2).filter(|&w| w <= PAGE_DIM)?;
+    let height = height.checked_add(2).filter(|&h| h <= PAGE_DIM)?;
+    Some(Size::new(width as i32, height as i32))
+}
 
-        self.descriptor.size.width = new_width;
-        self.descriptor.size.height = new_height;
+fn page_area() -> u64 {
+    PAGE_DIM as u64 * PAGE_DIM as u64
+}
 
-        let new_texture = self.device.create_texture(&self.descriptor);
+fn allocation_area(allocation: &Allocation) -> u64 {
+    allocation.rectangle.area() as u64
+}
 
-        let mut encoder = self.device.create_command_encoder(&Default::default());
-        encoder.copy_texture_to_texture(
-            wgpu::ImageCopyTexture {
-                texture: &self.texture,
-                mip_level: 0,
-                origin: wgpu::Origin3d::ZERO,
-                aspect: wgpu::TextureAspect::All,
-            },
-            wgpu::ImageCopyTexture {
-                texture: &new_texture,
-                mip_level: 0,
-                origin: wgpu::Origin3d::ZERO,
-                aspect: wgpu::TextureAspect::All,
-            },
-            wgpu::Extent3d {
-                width: old_width,
-                height: old_height,
-                depth_or_array_layers: 1,
-            },
+fn allocation_extent(entry: &Entry) -> wgpu::Extent3d {
+    wgpu::Extent3d {
+        width: entry.allocation.rectangle.width() as u32,
+        height: entry.allocation.rectangle.height() as u32,
+        depth_or_array_layers: 1,
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_padded_size() {
+        assert_eq!(padded_size(10, 20), Some(Size::new(12, 22)));
+        assert_eq!(
+            padded_size(PAGE_DIM - 2, PAGE_DIM - 2),
+            Some(Size::new(PAGE_DIM as i32, PAGE_DIM as i32))
         );
-        self.queue.submit(iter::once(encoder.finish()));
+        assert_eq!(padded_size(PAGE_DIM - 1, 1), None);
+        assert_eq!(padded_size(1, u32::MAX), None);
+    }
+
+    #[test]
+    fn test_full_atlas() {
+        let mut packer = Packer::new(1);
+        let size = padded_size(PAGE_DIM - 2, PAGE_DIM - 2).unwrap();
+        let entries: Vec<Entry> = (0..MAX_PAGES)
+            .map(|i| {
+                let entry = packer.allocate(size).unwrap();
+                assert_eq!(entry.page as usize, i);
+                entry
+            })
+            .collect();
+        assert_eq!(packer.pages.len(), MAX_PAGES);
+
+        // No page is added past the maximum.
+        assert!(packer.allocate(size).is_none());
+        assert!(packer.allocate(Size::new(3, 3)).is_none());
+        assert_eq!(packer.pages.len(), MAX_PAGES);
 
-        self.texture_view = new_texture.create_view(&Default::default());
-        self.texture = new_texture;
+        // Freed space is reused.
+        packer.deallocate(&entries[3]);
+        assert_eq!(packer.allocate(size).unwrap().page, 3);
     }
 }
@@ -1,10 +1,10 @@
-use std::{collections::BTreeMap, num::NonZeroU32};
+use std::{collections::BTreeMap, iter};
 
 use ahash::AHashMap;
 use glam::{uvec2, vec2, UVec2, Vec2};
 use rectangle_pack::{GroupedRectsToPlace, RectToInsert, TargetBin};
 
-use super::{AtlasEntry, TextureKey};
+use super::{upload::TextureUploads, AtlasEntry, TextureKey};
 
 #[derive(Debug, thiserror::Error)]
 #[error("textures cannot fit into texture atlas")]
@@ -165,6 +165,7 @@ impl StaticTextureAtlasBuilder {
         let texture = device.create_texture(&descriptor);
 
         // Write texture data
+        let mut uploads = TextureUploads::new(self.format);
         let mut entries = AHashMap::new();
         for (key, buffer) in self.textures {
             let placement = placements.packed_locations().get(&key).unwrap().1;
@@ -172,41 +173,27 @@ impl StaticTextureAtlasBuilder {
             entries.insert(
                 key,
                 AtlasEntry {
+                    page: 0,
                     pos: uvec2(placement.x() + PADDING / 2, placement.y() + PADDING / 2),
                     size: buffer.size,
                 },
             );
 
-            queue.write_texture(
-                wgpu::ImageCopyTexture {
-                    texture: &texture,
-                    mip_level: 0,
-                    origin: wgpu::Origin3d {
-                        x: placement.x() + PADDING / 2,
-                        y: placement.y() + PADDING / 2,
-                        z: 0,
-                    },
-                    aspect: wgpu::TextureAspect::All,
-                },
+            uploads.push(
                 &buffer.data,
-                wgpu::ImageDataLayout {
-                    offset: 0,
-                    bytes_per_row: Some(
-                        NonZeroU32::new(self.format.describe().block_size as u32 * buffer.size.x)
-                            .expect("texture width cannot be zero"),
-                    ),
-                    rows_per_image: Some(
-                        NonZeroU32::new(buffer.size.y).expect("texture height cannot be zero"),
-                    ),
-                },
-                wgpu::Extent3d {
-                    width: buffer.size.x,
-                    height: buffer.size.y,
-                    depth_or_array_layers: 1,
+                buffer.size,
+                wgpu::Origin3d {
+                    x: placement.x() + PADDING / 2,
+                    y: placement.y() + PADDING / 2,
+                    z: 0,
                 },
             );
         }
 
+        let mut encoder = device.create_command_encoder(&Default::default());
+        uploads.record(device, &mut encoder, &texture);
+        queue.submit(iter::once(encoder.finish()));
+
         Ok(StaticTextureAtlas {
             texture_view: texture.create_view(&Default::default()),
             texture,
@@ -0,0 +1,104 @@
+use std::{iter, num::NonZeroU32};
+
+use glam::UVec2;
+use wgpu::util::DeviceExt;
+
+/// Texture writes collected into a single staging buffer, so that
+/// many small textures can be uploaded with one buffer allocation
+/// and one submission instead of a `Queue::write_texture` call each.
+pub struct TextureUploads {
+    data: Vec<u8>,
+    copies: Vec<PendingCopy>,
+    block_size: u32,
+}
+
+struct PendingCopy {
+    offset: u64,
+    bytes_per_row: u32,
+    origin: wgpu::Origin3d,
+    size: UVec2,
+}
+
+impl TextureUploads {
+    pub fn new(format: wgpu::TextureFormat) -> Self {
+        Self {
+            data: Vec::new(),
+            copies: Vec::new(),
+            block_size: format.describe().block_size as u32,
+        }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.copies.is_empty()
+    }
+
+    /// Queues `texture`, a tightly packed image of `size`, to be written at `origin`.
+    pub fn push(&mut self, texture: &[u8], size: UVec2, origin: wgpu::Origin3d) {
+        let row_len = (self.block_size * size.x) as usize;
+        assert_eq!(texture.len(), row_len * size.y as usize);
+
+        // Rows in the staging buffer must be aligned.
+        let alignment = wgpu::COPY_BYTES_PER_ROW_ALIGNMENT as usize;
+        let bytes_per_row = (row_len + alignment - 1) / alignment * alignment;
+
+        let offset = self.data.len() as u64;
+        self.data.reserve(bytes_per_row * size.y as usize);
+        for row in texture.chunks_exact(row_len) {
+            self.data.extend_from_slice(row);
+            self.data
+                .extend(iter::repeat(0).take(bytes_per_row - row_len));
+        }
+
+        self.copies.push(PendingCopy {
+            offset,
+            bytes_per_row: bytes_per_row as u32,
+            origin,
+            size,
+        });
+    }
+
+    /// Records copies of all queued textures into `texture`.
+    pub fn record(
+        &mut self,
+        device: &wgpu::Device,
+        encoder: &mut wgpu::CommandEncoder,
+        texture: &wgpu::Texture,
+    ) {
+        if self.is_empty() {
+            return;
+        }
+
+        let staging_buffer = device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
+            label: Some("texture_uploads"),
+            contents: &self.data,
+            usage: wgpu::BufferUsages::COPY_SRC,
+        });
+
+        for copy in self.copies.drain(..) {
+            encoder.copy_buffer_to_texture(
+                wgpu::ImageCopyBuffer {
+                    buffer: &staging_buffer,
+                    layout: wgpu::ImageDataLayout {
+                        offset: copy.offset,
+                        bytes_per_row: Some(
+                            NonZeroU32::new(copy.bytes_per_row).expect("width is zero"),
+                        ),
+                        rows_per_image: Some(NonZeroU32::new(copy.size.y).expect("height is zero")),
+                    },
+                },
+                wgpu::ImageCopyTexture {
+                    texture,
+                    mip_level: 0,
+                    origin: copy.origin,
+                    aspect: wgpu::TextureAspect::All,
+                },
+                wgpu::Extent3d {
+                    width: copy.size.x,
+                    height: copy.size.y,
+                    depth_or_array_layers: 1,
+                },
+            );
+        }
+        self.data.clear();
+    }
+}
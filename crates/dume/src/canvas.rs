@@ -1,18 +1,53 @@
-use std::{iter, mem};
+use std::{iter, sync::Arc};
 
-use glam::{uvec2, vec2, Affine2, UVec2, Vec2};
+use glam::{uvec2, vec2, Affine2, Mat2, UVec2, Vec2};
 use kurbo::{PathEl, Point};
 use palette::Srgba;
-use swash::GlyphId;
+use swash::zeno::Placement;
 
 use crate::{
-    glyph::Glyph,
+    atlas::AtlasEntry,
+    glyph::{self, Glyph, GlyphKey},
     layer::Layer,
-    renderer::{Batch, LineSegment, Node, PaintType, Shape, StrokeCap},
-    text::layout::GlyphCharacter,
-    Context, FontId, Rect, Scissor, SpriteRotate, TextBlob, TextureId,
+    renderer::{Batch, LineSegment, Node, PaintType, RenderBuffers, Shape, StrokeCap},
+    text::layout::{BlobKey, GlyphCharacter},
+    Context, Rect, Scissor, SpriteRotate, Text, TextBlob, TextOptions, TextureId,
 };
 
+/// Glyph placements of a [`TextBlob`] from its last draw.
+pub(crate) struct TextDrawCache {
+    key: TextDrawKey,
+    /// Every glyph in the blob, to keep them from being evicted.
+    keys: Vec<GlyphKey>,
+    /// Glyphs with pixels, relative to the whole pixel
+    /// containing the physical position of the blob.
+    glyphs: Vec<PlacedGlyph>,
+}
+
+/// Everything glyph placements depend on besides the blob itself. The whole
+/// pixel part of the blob's position only offsets the placements.
+#[derive(Copy, Clone, Debug, PartialEq)]
+struct TextDrawKey {
+    scale_factor: f32,
+    transform: Mat2,
+    /// Subpixel offset of the blob's origin, quantized
+    /// like glyph positions are for rasterization.
+    subpixel_bucket: UVec2,
+    glyph_generation: u64,
+}
+
+#[derive(Copy, Clone, Debug)]
+struct PlacedGlyph {
+    entry: AtlasEntry,
+    placement: Placement,
+    sdf: bool,
+    /// Physical position of the glyph origin.
+    pos: Vec2,
+    /// Physical size
+    size: f32,
+    color: Srgba<u8>,
+}
+
 /// The current shape being drawn in a `Canvas`.
 #[derive(Debug, Copy, Clone)]
 enum PathType {
@@ -33,6 +68,7 @@ enum PathType {
 pub struct Canvas {
     context: Context,
     batch: Batch,
+    buffers: RenderBuffers,
 
     current_paint: PaintType,
     current_path: Vec<PathEl>,
@@ -54,9 +90,11 @@ impl Canvas {
         let batch = context
             .renderer()
             .create_batch(target_physical_size, scale_factor);
+        let buffers = context.renderer().create_render_buffers(context.device());
         Self {
             context,
             batch,
+            buffers,
             current_paint: PaintType::Solid(Srgba::default()),
             current_path: Vec::new(),
             current_path_type: PathType::Path,
@@ -356,74 +394,261 @@ impl Canvas {
         });
     }
 
+    /// Lays out and draws text without a [`TextBlob`] owned by the caller.
+    ///
+    /// The blob is cached on the [`Context`] by its text, options, and
+    /// `max_size`, so drawing the same text every frame only lays it out once.
+    /// Blobs not drawn for a few frames are dropped; see
+    /// [`ContextBuilder::text_cache_frames`](crate::ContextBuilder::text_cache_frames).
+    pub fn draw_str(
+        &mut self,
+        text: impl AsRef<Text>,
+        options: TextOptions,
+        max_size: Vec2,
+        pos: Vec2,
+    ) -> &mut Self {
+        let text = text.as_ref();
+        let key = BlobKey::new(text, &options, max_size);
+        let cached = self.context.text_cache().get(&key);
+        let blob = match cached {
+            Some(blob) => blob,
+            None => {
+                // Lay out without holding the cache lock, since layout
+                // takes the font and shaping locks.
+                let mut blob = self.context.create_text_blob(text, options.clone());
+                self.context.resize_text_blob(&mut blob, max_size);
+                let blob = Arc::new(blob);
+                self.context.text_cache().insert(&key, Arc::clone(&blob));
+                blob
+            }
+        };
+        self.draw_text(&blob, pos, 1.)
+    }
+
     /// Draws a blob of text.
     ///
     /// `pos` is the position of the top-left corner of the text.
     ///
     /// `alpha` is a multiplier applied to the alpha of each text section.
+    ///
+    /// Glyph placements are cached on the blob, so redrawing it with the same
+    /// scale and quantized subpixel position (see
+    /// [`ContextBuilder::glyph_subpixel_steps`](crate::ContextBuilder::glyph_subpixel_steps))
+    /// skips the glyph cache lookups.
     pub fn draw_text(&mut self, text: &TextBlob, pos: Vec2, alpha: f32) -> &mut Self {
-        for glyph in text.glyphs() {
-            // Apply alpha multiplier
-            let mut color = glyph.color;
-            color.alpha = (color.alpha as f32 * alpha) as u8;
+        let origin = self.current_transform.transform_point2(pos) * self.batch.scale_factor();
+
+        let mut draw_cache = text.draw_cache();
+        {
+            let glyphs = self.context.glyph_cache_read();
+            let key = TextDrawKey {
+                scale_factor: self.batch.scale_factor(),
+                transform: self.current_transform.matrix2,
+                subpixel_bucket: self.subpixel_bucket(origin),
+                glyph_generation: glyphs.generation(),
+            };
+            if let Some(cached) = draw_cache.as_ref().filter(|cached| cached.key == key) {
+                glyphs.mark_used(&cached.keys);
+                for glyph in &cached.glyphs {
+                    let node = self.glyph_node(glyph, origin.floor() + glyph.pos, alpha);
+                    self.batch.draw_node(node);
+                }
+                return self;
+            }
+        }
+
+        *draw_cache = self.draw_text_uncached(text, pos, origin, alpha);
+        self
+    }
 
+    /// Draws a blob of text by looking up each glyph in the glyph cache.
+    /// Returns the placements to cache on the blob, or `None` if it
+    /// contains icons, which are not cached.
+    fn draw_text_uncached(
+        &mut self,
+        text: &TextBlob,
+        pos: Vec2,
+        origin: Vec2,
+        alpha: f32,
+    ) -> Option<TextDrawCache> {
+        self.rasterize_missing_glyphs(text, pos);
+
+        let mut keys = Vec::new();
+        let mut placed = Vec::new();
+        let mut has_icons = false;
+
+        // All glyphs are now cached, so they are looked up
+        // with a single shared lock on the glyph cache.
+        let mut glyphs = self.context.glyph_cache_read();
+        let generation = glyphs.generation();
+        for glyph in text.glyphs(&self.context) {
             match &glyph.c {
                 GlyphCharacter::Glyph(glyph_id, size, _) => {
-                    self.draw_glyph(*glyph_id, glyph.font, *size, color, pos + glyph.pos);
+                    let (size, pos) = self.glyph_to_physical(*size, pos + glyph.pos);
+                    let key = glyphs.key(glyph.font, *glyph_id, size, pos);
+                    let resolved = match glyphs.lookup(&key) {
+                        Some(resolved) => resolved,
+                        None => {
+                            // Evicted by another canvas in the meantime.
+                            drop(glyphs);
+                            let resolved = self.context.glyph_cache().glyph_or_rasterize(
+                                &self.context,
+                                glyph.font,
+                                *glyph_id,
+                                size,
+                                pos,
+                            );
+                            glyphs = self.context.glyph_cache_read();
+                            resolved
+                        }
+                    };
+
+                    keys.push(key);
+                    let (placement, sdf) = match resolved {
+                        Glyph::Empty => continue,
+                        Glyph::InAtlas(_, placement) => (placement, false),
+                        Glyph::Sdf(_, placement) => (placement, true),
+                    };
+                    let glyph = PlacedGlyph {
+                        entry: glyphs.atlas_entry(&resolved).expect("glyph is not empty"),
+                        placement,
+                        sdf,
+                        pos: pos - origin.floor(),
+                        size,
+                        color: glyph.color,
+                    };
+                    let node = self.glyph_node(&glyph, pos, alpha);
+                    self.batch.draw_node(node);
+                    placed.push(glyph);
                 }
                 GlyphCharacter::LineBreak => {}
                 GlyphCharacter::Icon(texture_id, size) => {
+                    has_icons = true;
+                    drop(glyphs);
                     let dims = self.context.texture_dimensions(*texture_id);
                     let aspect_ratio = dims.y as f32 / dims.x as f32;
                     let height = aspect_ratio * *size;
                     self.draw_sprite(*texture_id, glyph.pos - vec2(0., height), *size);
+                    glyphs = self.context.glyph_cache_read();
                 }
             }
         }
-        self
+
+        // Placements are only valid if no glyph
+        // was inserted or evicted while drawing.
+        if has_icons || glyphs.generation() != generation {
+            return None;
+        }
+        Some(TextDrawCache {
+            key: TextDrawKey {
+                scale_factor: self.batch.scale_factor(),
+                transform: self.current_transform.matrix2,
+                subpixel_bucket: self.subpixel_bucket(origin),
+                glyph_generation: generation,
+            },
+            keys,
+            glyphs: placed,
+        })
     }
 
-    fn draw_glyph(
-        &mut self,
-        glyph_id: GlyphId,
-        font: FontId,
-        size: f32,
-        color: Srgba<u8>,
-        pos: Vec2,
-    ) {
-        let scale_factor = self.batch.scale_factor();
-        // Convert to physical pixels
-        let size = self.current_transform_scale * size * scale_factor;
-        let pos = self.current_transform.transform_point2(pos) * scale_factor;
+    /// Rasterizes all glyphs in a blob that are not yet cached
+    /// in parallel, so that drawing the blob only hits the cache.
+    ///
+    /// With background rasterization, the glyphs are queued instead.
+    fn rasterize_missing_glyphs(&self, text: &TextBlob, pos: Vec2) {
+        let text_glyphs = text.glyphs(&self.context);
+        let missing =
+            self.context
+                .glyph_cache_read()
+                .missing_glyphs(text_glyphs.iter().filter_map(|glyph| match glyph.c {
+                    GlyphCharacter::Glyph(glyph_id, size, _) => {
+                        let (size, pos) = self.glyph_to_physical(size, pos + glyph.pos);
+                        Some((glyph.font, glyph_id, size, pos))
+                    }
+                    _ => None,
+                }));
+        if missing.is_empty() {
+            return;
+        }
 
-        let mut glyphs = self.context.glyph_cache();
-        let glyph = glyphs.glyph_or_rasterize(&self.context, font, glyph_id, size, pos);
+        #[cfg(not(target_arch = "wasm32"))]
+        if self.context.glyph_cache_read().rasterizes_in_background() {
+            self.context.glyph_cache().mark_pending(&missing);
+            glyph::rasterize_in_background(self.context.clone(), missing);
+            return;
+        }
 
-        let (key, placement) = match glyph {
-            Glyph::Empty => return,
-            Glyph::InAtlas(k, p) => (k, p),
-        };
-        let pos = (pos + vec2(placement.left as f32, -placement.top as f32)).floor();
+        let rasterized = glyph::rasterize_all(&self.context.fonts(), &missing);
+        self.context.glyph_cache().insert_rasterized(rasterized);
+    }
 
-        let entry = glyphs.atlas().get(key);
+    /// Quantizes the subpixel part of a physical position
+    /// to the steps glyphs are rasterized at.
+    fn subpixel_bucket(&self, pos: Vec2) -> UVec2 {
+        let steps = self.context.settings().glyph_subpixel_steps;
+        (pos.fract() * steps.as_vec2())
+            .as_uvec2()
+            .min(steps - UVec2::ONE)
+    }
 
-        self.batch.draw_node(Node {
+    /// Converts a glyph's size and position to physical pixels.
+    fn glyph_to_physical(&self, size: f32, pos: Vec2) -> (f32, Vec2) {
+        let scale_factor = self.batch.scale_factor();
+        (
+            self.current_transform_scale * size * scale_factor,
+            self.current_transform.transform_point2(pos) * scale_factor,
+        )
+    }
+
+    /// Creates the node drawing a glyph at the given physical position.
+    fn glyph_node(&self, glyph: &PlacedGlyph, pos: Vec2, alpha: f32) -> Node {
+        let scale_factor = self.batch.scale_factor();
+        let entry = glyph.entry;
+
+        // Apply alpha multiplier
+        let mut color = glyph.color;
+        color.alpha = (color.alpha as f32 * alpha) as u8;
+
+        let placement = glyph.placement;
+        let (paint_type, rect) = if glyph.sdf {
+            // Distance field glyphs are scaled from `SDF_SIZE` to the glyph size.
+            // Unlike bitmap glyphs, they are not snapped to whole pixels.
+            let scale = glyph.size / glyph::SDF_SIZE;
+            let pos = pos + vec2(placement.left as f32, -placement.top as f32) * scale;
+            (
+                PaintType::SdfGlyph {
+                    page: entry.page,
+                    offset_in_atlas: entry.pos,
+                    size_in_atlas: entry.size,
+                    origin: pos,
+                    texels_per_pixel: 1. / scale,
+                    color,
+                },
+                Rect::new(pos, entry.size.as_vec2() * scale),
+            )
+        } else {
+            let pos = (pos + vec2(placement.left as f32, -placement.top as f32)).floor();
+            (
+                PaintType::Glyph {
+                    page: entry.page,
+                    offset_in_atlas: entry.pos,
+                    origin: pos.as_uvec2(),
+                    color,
+                },
+                Rect::new(pos, uvec2(placement.width, placement.height).as_vec2()),
+            )
+        };
+
+        Node {
             transform: Affine2::IDENTITY, // transform applied manually
-            paint_type: PaintType::Glyph {
-                offset_in_atlas: entry.pos,
-                origin: pos.as_uvec2(),
-                color,
-            },
+            paint_type,
             shape: Shape::Rect {
-                rect: Rect {
-                    pos: pos / scale_factor,
-                    size: uvec2(placement.width, placement.height).as_vec2() / scale_factor,
-                },
+                rect: Rect::new(rect.pos / scale_factor, rect.size / scale_factor),
                 border_radius: 0.,
                 stroke_width: None,
             },
             scissor: self.scissor,
-        });
+        }
     }
 
     /// Draws a texture / sprite on the canvas.
@@ -515,11 +740,53 @@ impl Canvas {
     }
 }
 
+/// Partial repaint
+impl Canvas {
+    /// Hints that the pixels inside `region` have moved by `delta` since the
+    /// last frame rendered to the target layer, e.g. because a list was scrolled
+    /// or a map was panned.
+    ///
+    /// On the next [`render_to_layer`](Self::render_to_layer), the layer's existing pixels
+    /// within `region` are shifted by `delta` on the GPU. Only the tiles containing
+    /// newly exposed pixels (and any regions passed to [`invalidate`](Self::invalidate))
+    /// are painted; all other tiles keep their previous contents.
+    ///
+    /// Call this before drawing the frame, since draw commands that do not touch a repainted
+    /// tile are skipped. The full scene, including an opaque background, should still be drawn:
+    /// repainted tiles are drawn from scratch.
+    ///
+    /// `region` and `delta` are in logical pixels and are not affected by the canvas transform.
+    /// `delta` is rounded to whole physical pixels.
+    pub fn scroll(&mut self, region: Rect, delta: Vec2) -> &mut Self {
+        self.batch.scroll(region, delta);
+        self
+    }
+
+    /// Marks a region, in logical pixels, as changed since the last frame rendered to
+    /// the target layer.
+    ///
+    /// Once this or [`scroll`](Self::scroll) is called, the next
+    /// [`render_to_layer`](Self::render_to_layer) only paints the tiles intersecting
+    /// invalidated or scrolled-in regions.
+    pub fn invalidate(&mut self, region: Rect) -> &mut Self {
+        self.batch.invalidate(region);
+        self
+    }
+}
+
 /// Rendering functions
 impl Canvas {
     /// Renders a frame into a new layer and then blits it directly onto `target_texture`.
     /// `target_texture` must have `TextureUsages::RENDER_ATTACHMENT`.
+    ///
+    /// # Panics
+    /// Panics if [`scroll`](Self::scroll) or [`invalidate`](Self::invalidate) was called,
+    /// since partial repaints need a persistent layer.
     pub fn render(&mut self, target_texture: &wgpu::TextureView) {
+        assert!(
+            !self.batch.has_damage(),
+            "partial repaints require rendering to a persistent layer"
+        );
         let temp_layer = self.context.create_layer(self.batch.physical_size());
         self.render_to_layer(&temp_layer);
         temp_layer.blit_onto(target_texture);
@@ -530,6 +797,9 @@ impl Canvas {
     /// Note that the layer is _not_ cleared. That means any existing contents
     /// will not be overwritten unless they are explicitly drawn over.
     ///
+    /// If the context is not [ready](Context::is_ready), the draw commands
+    /// are discarded and the layer is left untouched.
+    ///
     /// # Panics
     /// Panics if the layer's physical size does not match the size of the canvas.
     pub fn render_to_layer(&mut self, layer: &Layer) {
@@ -539,31 +809,40 @@ impl Canvas {
             "target layer size does not match canvas size"
         );
 
-        let physical_size = self.batch.physical_size();
-        let scale_factor = self.batch.scale_factor();
-        let batch = mem::replace(
-            &mut self.batch,
-            self.context
-                .renderer()
-                .create_batch(physical_size, scale_factor),
-        );
+        if !self.context.is_ready() {
+            // Pipelines are still compiling; drop this frame.
+            self.batch.clear();
+            self.reset();
+            return;
+        }
 
-        // Prepare to render
-        let prepared =
-            self.context
-                .renderer()
-                .prepare_render(batch, &self.context, layer.texture());
+        let scrolls = self.batch.take_scrolls();
+        self.context.glyph_cache().flush_uploads();
 
-        // Render
         let mut encoder = self
             .context
             .device()
             .create_command_encoder(&Default::default());
 
+        // Prepare to render
+        let prepared = self.context.renderer().prepare_render(
+            &mut self.batch,
+            &self.context,
+            layer.texture_view(),
+            &mut self.buffers,
+            &mut encoder,
+        );
+
+        // Render
+        self.context
+            .renderer()
+            .scroll_layer(&self.context, &mut encoder, layer, &scrolls);
         self.context.renderer().render(prepared, &mut encoder);
 
         self.context.queue().submit(iter::once(encoder.finish()));
+        self.buffers.recall();
 
+        self.batch.clear();
         self.reset();
     }
 
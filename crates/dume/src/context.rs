@@ -1,19 +1,26 @@
-use std::{sync::Arc, time::Duration};
+use std::{io, path::PathBuf, sync::Arc, time::Duration};
 
 use glam::{uvec2, UVec2, Vec2};
-use parking_lot::{Mutex, MutexGuard, RwLock, RwLockReadGuard};
+use instant::Instant;
+use parking_lot::{Mutex, MutexGuard, RwLock, RwLockReadGuard, RwLockWriteGuard};
+use swash::GlyphId;
 
 use crate::{
-    font::{Font, Fonts, MalformedFont},
-    glyph::GlyphCache,
+    font::{Font, FontData, FontId, Fonts, MalformedFont, MissingFont, Query},
+    glyph::{self, GlyphAntialiasing, GlyphCache},
     renderer::Renderer,
+    text::layout::{BlobCache, ShapeCache, ShapeCacheStats},
     texture::{MissingTexture, TextureId, TextureSet, TextureSetBuilder, Textures},
-    yuv, Canvas, Layer, Text, TextBlob, TextOptions, YuvTexture,
+    yuv, Canvas, IntermediateFormat, Layer, Text, TextBlob, TextOptions, YuvTexture,
 };
 
+/// Called when glyphs rasterized in the background become available.
+pub(crate) type GlyphsReadyCallback = Arc<dyn Fn() + Send + Sync>;
+
 /// Builder for a [`Context`].
 pub struct ContextBuilder {
     settings: Settings,
+    on_glyphs_ready: Option<GlyphsReadyCallback>,
     device: Arc<wgpu::Device>,
     queue: Arc<wgpu::Queue>,
 }
@@ -31,8 +38,16 @@ impl ContextBuilder {
         self
     }
 
+    /// Sets how glyph edges are antialiased.
+    ///
+    /// The default is [`GlyphAntialiasing::Subpixel`].
+    pub fn glyph_antialiasing(mut self, antialiasing: GlyphAntialiasing) -> Self {
+        self.settings.glyph_antialiasing = antialiasing;
+        self
+    }
+
     /// Sets the duration before an unused glyph is evicted from the texture atlas,
-    /// freeing space for other glyphs.
+    /// freeing space for other glyphs. Glyphs are only evicted in [`Context::end_frame`].
     ///
     /// The default is 10 seconds.
     pub fn glyph_expire_duration(mut self, duration: Duration) -> Self {
@@ -40,6 +55,102 @@ impl ContextBuilder {
         self
     }
 
+    /// Sets the maximum number of bytes of glyph atlas space used by cached glyphs.
+    /// Once exceeded, the least recently used glyphs are evicted in
+    /// [`Context::end_frame`], even if they have not expired yet.
+    ///
+    /// By default, there is no limit.
+    pub fn glyph_cache_budget(mut self, bytes: usize) -> Self {
+        self.settings.glyph_cache_budget = Some(bytes);
+        self
+    }
+
+    /// Sets the number of glyph atlas pages to create up front.
+    /// Each page is a separate 2048x2048 texture. More pages are
+    /// added as needed, without copying existing pages, up to a
+    /// maximum of 8.
+    ///
+    /// The default value is 1.
+    pub fn glyph_atlas_pages(mut self, pages: u32) -> Self {
+        assert!(pages > 0, "at least one glyph atlas page is required");
+        assert!(
+            pages as usize <= crate::atlas::dynamic::MAX_PAGES,
+            "too many glyph atlas pages"
+        );
+        self.settings.glyph_atlas_pages = pages;
+        self
+    }
+
+    /// Rasterizes glyphs missing from the cache on a background thread
+    /// instead of stalling the frame that first draws them. Until a glyph
+    /// is ready, a cached variant of it with a different subpixel offset
+    /// is drawn instead, or nothing if there is none.
+    ///
+    /// `on_ready` is called from the background thread whenever new glyphs
+    /// become available, so that the application can request a redraw.
+    ///
+    /// Ignored on the web, where threads are unavailable.
+    pub fn async_glyph_rasterization(
+        mut self,
+        on_ready: impl Fn() + Send + Sync + 'static,
+    ) -> Self {
+        self.settings.async_glyph_rasterization = true;
+        self.on_glyphs_ready = Some(Arc::new(on_ready));
+        self
+    }
+
+    /// Enables a cache of rasterized glyphs stored in the file at `path`.
+    ///
+    /// Glyphs in the file are uploaded to the atlas as soon as their font is added,
+    /// so text drawn at startup does not need to be rasterized. Call
+    /// [`Context::save_glyph_cache`] to write the currently cached glyphs back.
+    /// Unreadable files and files written with different settings are ignored.
+    pub fn glyph_disk_cache(mut self, path: impl Into<PathBuf>) -> Self {
+        self.settings.glyph_disk_cache = Some(path.into());
+        self
+    }
+
+    /// Draws glyphs at or above `size` physical pixels as signed distance
+    /// fields. A distance field is rasterized once per glyph and reused at
+    /// every size, so text that is large or changes size each frame
+    /// does not fill the cache with bitmaps.
+    ///
+    /// Distance field glyphs are unhinted and lose some detail
+    /// at sharp corners, so small text should keep using bitmaps.
+    pub fn sdf_glyph_min_size(mut self, size: f32) -> Self {
+        self.settings.sdf_glyph_min_size = Some(size);
+        self
+    }
+
+    /// Draws all glyphs of fonts whose family starts with `family` as signed
+    /// distance fields, regardless of size. Useful for animated or scaled text.
+    pub fn sdf_font_family(mut self, family: impl Into<String>) -> Self {
+        self.settings.sdf_font_families.push(family.into());
+        self
+    }
+
+    /// Sets the number of shaped text runs to keep for reuse by
+    /// new text blobs. Each run is a span of text with a single
+    /// style, script, and direction.
+    ///
+    /// The default value is 1024.
+    pub fn shape_cache_capacity(mut self, runs: usize) -> Self {
+        assert!(runs > 0, "shape cache capacity must be positive");
+        self.settings.shape_cache_capacity = runs;
+        self
+    }
+
+    /// Sets the number of frames a text blob created by
+    /// [`Canvas::draw_str`](crate::Canvas::draw_str) is kept
+    /// after it was last drawn. Frames are counted by [`Context::end_frame`].
+    ///
+    /// The default value is 8.
+    pub fn text_cache_frames(mut self, frames: u32) -> Self {
+        assert!(frames > 0, "text cache frames must be positive");
+        self.settings.text_cache_frames = frames;
+        self
+    }
+
     /// Sets the maximum number of mipmap levels to generate for each texture.
     /// Using a value of 1 disables mipmapping.
     ///
@@ -49,14 +160,80 @@ impl ContextBuilder {
         self
     }
 
-    /// Builds the context.
+    /// Sets the pixel format of layers.
+    ///
+    /// The default is [`IntermediateFormat::Srgb8`].
+    pub fn intermediate_format(mut self, format: IntermediateFormat) -> Self {
+        self.settings.intermediate_format = format;
+        self
+    }
+
+    /// Sets the side length in physical pixels of the tiles the
+    /// renderer bins draw commands into. Must be a power of two between 4 and 64.
+    ///
+    /// Smaller tiles suit scenes with many small elements, such as text,
+    /// since each pixel considers fewer nodes. Larger tiles reduce binning
+    /// overhead for scenes with fewer, larger elements such as sprites.
+    ///
+    /// The default value is 16.
+    pub fn tile_size(mut self, size: u32) -> Self {
+        assert!(
+            size.is_power_of_two() && (4..=64).contains(&size),
+            "tile size must be a power of two between 4 and 64"
+        );
+        self.settings.tile_size = size;
+        self
+    }
+
+    /// Sets the maximum number of draw commands that can touch one tile.
+    /// Excess commands are skipped.
+    ///
+    /// Nodes for each tile are staged in workgroup memory, so
+    /// the capacity is limited to 256.
+    ///
+    /// The default value is 64.
+    pub fn tile_capacity(mut self, capacity: u32) -> Self {
+        assert!(
+            (1..=256).contains(&capacity),
+            "tile capacity must be between 1 and 256"
+        );
+        self.settings.tile_capacity = capacity;
+        self
+    }
+
+    /// Builds the context, compiling all GPU pipelines before returning.
     pub fn build(self) -> Context {
+        self.build_inner(false)
+    }
+
+    /// Builds the context, compiling GPU pipelines on a background thread
+    /// so that this function returns quickly.
+    ///
+    /// Until compilation completes, [`Context::is_ready`] returns `false`,
+    /// rendering a canvas discards its draw commands, and blitting
+    /// clears the target to black.
+    ///
+    /// On the web, where threads are unavailable, this is equivalent to [`build`](Self::build).
+    pub fn build_in_background(self) -> Context {
+        self.build_inner(true)
+    }
+
+    fn build_inner(self, background: bool) -> Context {
+        let start = Instant::now();
+        let renderer = Renderer::new(&self.device, &self.settings, background);
+        let glyph_cache = GlyphCache::new(&self.device, &self.queue, &self.settings);
+        let build_time = start.elapsed();
+
         Context(Arc::new(Inner {
-            renderer: Renderer::new(&self.device),
+            renderer,
+            build_time,
+            on_glyphs_ready: self.on_glyphs_ready,
 
             textures: RwLock::new(Textures::default()),
             fonts: RwLock::new(Fonts::default()),
-            glyph_cache: Mutex::new(GlyphCache::new(&self.device, &self.queue, &self.settings)),
+            glyph_cache: RwLock::new(glyph_cache),
+            shape_cache: Mutex::new(ShapeCache::new(self.settings.shape_cache_capacity)),
+            text_cache: Mutex::new(BlobCache::new(self.settings.text_cache_frames)),
 
             settings: self.settings,
 
@@ -66,23 +243,67 @@ impl ContextBuilder {
     }
 }
 
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub(crate) struct Settings {
     pub(crate) glyph_subpixel_steps: UVec2,
+    pub(crate) glyph_antialiasing: GlyphAntialiasing,
     pub(crate) glyph_expire_duration: Duration,
+    pub(crate) glyph_cache_budget: Option<usize>,
+    pub(crate) glyph_atlas_pages: u32,
+    pub(crate) async_glyph_rasterization: bool,
+    pub(crate) glyph_disk_cache: Option<PathBuf>,
+    pub(crate) sdf_glyph_min_size: Option<f32>,
+    pub(crate) sdf_font_families: Vec<String>,
+    pub(crate) shape_cache_capacity: usize,
+    pub(crate) text_cache_frames: u32,
     pub(crate) max_mipmap_levels: u32,
+    pub(crate) intermediate_format: IntermediateFormat,
+    pub(crate) tile_size: u32,
+    pub(crate) tile_capacity: u32,
 }
 
 impl Default for Settings {
     fn default() -> Self {
         Self {
             glyph_subpixel_steps: uvec2(2, 4),
+            glyph_antialiasing: GlyphAntialiasing::default(),
             glyph_expire_duration: Duration::from_secs(10),
+            glyph_cache_budget: None,
+            glyph_atlas_pages: 1,
+            async_glyph_rasterization: false,
+            glyph_disk_cache: None,
+            sdf_glyph_min_size: None,
+            sdf_font_families: Vec::new(),
+            shape_cache_capacity: 1024,
+            text_cache_frames: 8,
             max_mipmap_levels: 4,
+            intermediate_format: IntermediateFormat::default(),
+            tile_size: 16,
+            tile_capacity: 64,
         }
     }
 }
 
+/// Timings of [`Context`] initialization.
+#[derive(Copy, Clone, Debug)]
+pub struct StartupStats {
+    /// Time the context builder blocked the calling thread.
+    pub build_time: Duration,
+    /// Time spent compiling GPU pipelines, or `None` if
+    /// they are still being compiled in the background.
+    pub pipeline_compile_time: Option<Duration>,
+}
+
+/// Result of [`Context::prewarm_glyphs`].
+#[derive(Copy, Clone, Debug)]
+pub struct GlyphPrewarmStats {
+    /// Number of glyphs rasterized. Glyphs that were
+    /// already cached are not counted.
+    pub glyphs: usize,
+    /// Glyph atlas space used by the new glyphs, in bytes.
+    pub atlas_bytes: usize,
+}
+
 /// The thread-safe Dume context. Stores all images,
 /// fonts, and GPU state needed for rendering.
 ///
@@ -97,24 +318,46 @@ struct Inner {
     settings: Settings,
 
     renderer: Renderer,
+    build_time: Duration,
+    on_glyphs_ready: Option<GlyphsReadyCallback>,
 
     device: Arc<wgpu::Device>,
     queue: Arc<wgpu::Queue>,
 
     textures: RwLock<Textures>,
     fonts: RwLock<Fonts>,
-    glyph_cache: Mutex<GlyphCache>,
+    glyph_cache: RwLock<GlyphCache>,
+    shape_cache: Mutex<ShapeCache>,
+    text_cache: Mutex<BlobCache>,
 }
 
 impl Context {
     pub fn builder(device: Arc<wgpu::Device>, queue: Arc<wgpu::Queue>) -> ContextBuilder {
         ContextBuilder {
             settings: Settings::default(),
+            on_glyphs_ready: None,
             device,
             queue,
         }
     }
 
+    /// Returns whether the context has finished compiling its
+    /// pipelines and can render.
+    ///
+    /// Always `true` unless the context was created with
+    /// [`ContextBuilder::build_in_background`].
+    pub fn is_ready(&self) -> bool {
+        self.0.renderer.is_ready()
+    }
+
+    /// Gets timings of the context's initialization.
+    pub fn startup_stats(&self) -> StartupStats {
+        StartupStats {
+            build_time: self.0.build_time,
+            pipeline_compile_time: self.0.renderer.pipeline_compile_time(),
+        }
+    }
+
     pub fn create_texture_set_builder(&self) -> TextureSetBuilder {
         TextureSetBuilder::new(self.clone())
     }
@@ -128,21 +371,137 @@ impl Context {
     }
 
     pub fn texture_dimensions(&self, texture: TextureId) -> UVec2 {
-        self.textures()
-            .texture_set(self.textures().set_for_texture(texture))
+        let textures = self.textures();
+        textures
+            .texture_set(textures.set_for_texture(texture))
             .get(texture)
             .size()
     }
 
-    pub fn add_font(&self, font_data: Vec<u8>) -> Result<(), MalformedFont> {
-        self.0.fonts.write().add(Font::from_data(font_data)?);
+    /// Adds a font file, or every font in a font collection (`.ttc`).
+    ///
+    /// `font_data` can be a `Vec<u8>`, an `Arc<[u8]>`, static bytes,
+    /// or a [`FontData`] wrapping e.g. a memory-mapped file. Faces
+    /// of a collection share the data. Fonts are not parsed until
+    /// they are first needed to resolve a font query.
+    pub fn add_font(&self, font_data: impl Into<FontData>) -> Result<(), MalformedFont> {
+        let font_data = font_data.into();
+        let faces = Font::load_all(&font_data)?;
+        let ids: Vec<FontId> = {
+            let mut fonts = self.0.fonts.write();
+            faces.into_iter().map(|face| fonts.add(face)).collect()
+        };
+
+        let settings = self.settings();
+        if !settings.sdf_font_families.is_empty() {
+            for &font in &ids {
+                let family = self.fonts().family_name(font).to_owned();
+                if settings
+                    .sdf_font_families
+                    .iter()
+                    .any(|sdf_family| family.starts_with(sdf_family.as_str()))
+                {
+                    self.glyph_cache().enable_sdf_for_font(font);
+                }
+            }
+        }
+
+        if settings.glyph_disk_cache.is_some() {
+            for &font in &ids {
+                let font_hash = glyph::hash_face(self.fonts().get(font));
+                self.glyph_cache().load_font_from_disk(font, font_hash);
+            }
+        }
+
         Ok(())
     }
 
+    /// Marks the end of an application frame, evicting glyphs and
+    /// text blobs that have gone unused.
+    ///
+    /// Call this once per frame, after every canvas has been rendered
+    /// and while no canvas has draw commands recorded but not yet
+    /// rendered: evicted glyphs free atlas space those commands may
+    /// still refer to. If it is never called, nothing is evicted.
+    pub fn end_frame(&self) {
+        self.glyph_cache().end_frame();
+        self.text_cache().end_frame();
+    }
+
+    /// Writes the currently cached glyphs to the file set
+    /// with [`ContextBuilder::glyph_disk_cache`]. Does nothing if
+    /// the disk cache is disabled.
+    ///
+    /// This blocks until the glyphs have been read back from the GPU.
+    pub fn save_glyph_cache(&self) -> io::Result<()> {
+        self.glyph_cache().save_to_disk()
+    }
+
     pub fn set_default_font_family(&self, family: impl Into<String>) {
         self.0.fonts.write().set_default_family(family.into());
     }
 
+    /// Sets the font families to draw characters with when the
+    /// font selected for a text section has no glyph for them.
+    /// Families are tried in order.
+    ///
+    /// Affects text blobs created after the call.
+    pub fn set_fallback_font_families<S: Into<String>>(
+        &self,
+        families: impl IntoIterator<Item = S>,
+    ) {
+        self.0
+            .fonts
+            .write()
+            .set_fallback_families(families.into_iter().map(Into::into).collect());
+    }
+
+    /// Rasterizes the glyphs for `chars` in the font matching `query`
+    /// at each of `sizes`, so that text using them later does not stall
+    /// on rasterization. Sizes are in physical pixels, i.e. the text size
+    /// multiplied by the canvas scale factor.
+    ///
+    /// If `subpixel_variants` is set, glyphs are rasterized at every subpixel
+    /// offset (see [`ContextBuilder::glyph_subpixel_steps`]). Otherwise, only
+    /// glyphs aligned to whole pixels are prepared.
+    ///
+    /// Glyphs are rasterized in parallel, and the glyph cache is only locked
+    /// to insert the results, so this can be called from a loading thread
+    /// while other threads render. Prewarmed glyphs still expire if unused.
+    pub fn prewarm_glyphs(
+        &self,
+        query: &Query,
+        sizes: &[f32],
+        chars: &str,
+        subpixel_variants: bool,
+    ) -> Result<GlyphPrewarmStats, MissingFont> {
+        let (font, glyph_ids) = {
+            let fonts = self.fonts();
+            let font = fonts.query(query)?;
+            let charmap = fonts.get(font).charmap();
+            let mut glyph_ids: Vec<GlyphId> = chars.chars().map(|c| charmap.map(c)).collect();
+            glyph_ids.sort_unstable();
+            glyph_ids.dedup();
+            (font, glyph_ids)
+        };
+
+        let requests =
+            self.glyph_cache_read()
+                .prewarm_requests(font, &glyph_ids, sizes, subpixel_variants);
+        let rasterized = glyph::rasterize_all(&self.fonts(), &requests);
+        let atlas_bytes = {
+            let mut glyphs = self.glyph_cache();
+            let atlas_bytes = glyphs.insert_rasterized(rasterized);
+            glyphs.flush_uploads();
+            atlas_bytes
+        };
+
+        Ok(GlyphPrewarmStats {
+            glyphs: requests.len(),
+            atlas_bytes,
+        })
+    }
+
     pub fn create_canvas(&self, target_physical_size: UVec2, hidpi_factor: f32) -> Canvas {
         Canvas::new(self.clone(), target_physical_size, hidpi_factor)
     }
@@ -155,6 +514,12 @@ impl Context {
         TextBlob::new(self, text.as_ref(), options)
     }
 
+    /// Gets hit and miss counts of the cache of shaped text runs
+    /// shared by text blobs. See [`ContextBuilder::shape_cache_capacity`].
+    pub fn shape_cache_stats(&self) -> ShapeCacheStats {
+        self.shape_cache().stats()
+    }
+
     pub fn resize_text_blob(&self, blob: &mut TextBlob, new_size: Vec2) {
         blob.resize(self, new_size);
     }
@@ -181,8 +546,21 @@ impl Context {
         self.0.fonts.read()
     }
 
-    pub(crate) fn glyph_cache(&self) -> MutexGuard<GlyphCache> {
-        self.0.glyph_cache.lock()
+    pub(crate) fn shape_cache(&self) -> MutexGuard<ShapeCache> {
+        self.0.shape_cache.lock()
+    }
+
+    pub(crate) fn text_cache(&self) -> MutexGuard<BlobCache> {
+        self.0.text_cache.lock()
+    }
+
+    pub(crate) fn glyph_cache(&self) -> RwLockWriteGuard<GlyphCache> {
+        self.0.glyph_cache.write()
+    }
+
+    /// Shared access to the glyph cache, which is enough to look up cached glyphs.
+    pub(crate) fn glyph_cache_read(&self) -> RwLockReadGuard<GlyphCache> {
+        self.0.glyph_cache.read()
     }
 
     pub fn device(&self) -> &Arc<wgpu::Device> {
@@ -193,6 +571,10 @@ impl Context {
         &self.0.queue
     }
 
+    pub(crate) fn on_glyphs_ready(&self) -> Option<&GlyphsReadyCallback> {
+        self.0.on_glyphs_ready.as_ref()
+    }
+
     pub(crate) fn settings(&self) -> &Settings {
         &self.0.settings
     }
@@ -2,9 +2,21 @@
 //!
 //! Font parsing, shaping, and rendering is handled by the `swash` crate.
 
+use std::{
+    fmt::{self, Debug},
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc,
+    },
+};
+
+use ahash::AHashMap;
+use once_cell::sync::OnceCell;
+use parking_lot::RwLock;
 use serde::{Deserialize, Serialize};
+use smallvec::SmallVec;
 use smartstring::{LazyCompact, SmartString};
-use swash::{CacheKey, FontRef, StringId};
+use swash::{CacheKey, FontDataRef, FontRef, Metrics, StringId};
 
 /// A font weight, indicating how dark it appears.
 #[derive(Debug, Copy, Clone, PartialEq, Eq, Hash, Deserialize, Serialize)]
@@ -103,23 +115,6 @@ impl Query {
         self.family = Some(family.into());
         self
     }
-
-    fn matches(&self, font: &FontRef, default_family: Option<&str>) -> bool {
-        let attributes = font.attributes();
-
-        attributes.style() == swash::Style::from(self.style)
-            && attributes.weight() == swash::Weight::from(self.weight)
-            && font
-                .localized_strings()
-                .find_by_id(StringId::Family, None)
-                .expect("missing font family string")
-                .to_string()
-                .starts_with(self.family.as_ref().map(|c| c.as_ref()).unwrap_or_else(|| {
-                    default_family.expect(
-                        "no default font family was set, but font::Query uses None as the family",
-                    )
-                }))
-    }
 }
 
 #[derive(Debug, thiserror::Error)]
@@ -130,49 +125,281 @@ pub struct MalformedFont;
 #[error("no font satisfied the query {0:#?}")]
 pub struct MissingFont(Query);
 
+/// The bytes of a font file, shared by every face in the file.
+///
+/// Cloning is cheap. Besides owned and static bytes, any byte container
+/// can be used, such as a memory-mapped file, so that large fonts are
+/// paged in on demand rather than copied into memory.
+#[derive(Clone)]
+pub struct FontData(Arc<dyn AsRef<[u8]> + Send + Sync>);
+
+impl FontData {
+    pub fn new(data: impl AsRef<[u8]> + Send + Sync + 'static) -> Self {
+        Self(Arc::new(data))
+    }
+
+    pub fn bytes(&self) -> &[u8] {
+        (*self.0).as_ref()
+    }
+}
+
+impl From<Vec<u8>> for FontData {
+    fn from(data: Vec<u8>) -> Self {
+        Self::new(data)
+    }
+}
+
+impl From<Arc<[u8]>> for FontData {
+    fn from(data: Arc<[u8]>) -> Self {
+        Self::new(data)
+    }
+}
+
+impl From<&'static [u8]> for FontData {
+    fn from(data: &'static [u8]) -> Self {
+        Self::new(data)
+    }
+}
+
+impl Debug for FontData {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("FontData")
+            .field("len", &self.bytes().len())
+            .finish()
+    }
+}
+
 pub(crate) struct Font {
-    data: Vec<u8>,
+    data: FontData,
     key: CacheKey,
     offset: u32,
+    /// Parsed when the font is first queried.
+    info: OnceCell<FontInfo>,
+    /// Built when the font is first considered for fallback.
+    coverage: OnceCell<Coverage>,
+}
+
+struct FontInfo {
+    family: String,
+    face: FaceKey,
+    metrics: Metrics,
 }
 
 impl Font {
-    pub fn from_data(data: Vec<u8>) -> Result<Self, MalformedFont> {
-        let font = FontRef::from_index(&data, 0).ok_or(MalformedFont)?;
-        let FontRef { key, offset, .. } = font;
-        Ok(Self { data, key, offset })
+    /// Loads every face in a font file or collection.
+    pub fn load_all(data: &FontData) -> Result<Vec<Self>, MalformedFont> {
+        let num_faces = FontDataRef::new(data.bytes()).ok_or(MalformedFont)?.len();
+        (0..num_faces)
+            .map(|index| {
+                let FontRef { key, offset, .. } =
+                    FontRef::from_index(data.bytes(), index).ok_or(MalformedFont)?;
+                Ok(Self {
+                    data: data.clone(),
+                    key,
+                    offset,
+                    info: OnceCell::new(),
+                    coverage: OnceCell::new(),
+                })
+            })
+            .collect()
     }
 
     /// The main entrypoint to access font data through `swash`.
     pub fn as_ref(&self) -> FontRef {
         FontRef {
-            data: &self.data,
+            data: self.data.bytes(),
             key: self.key,
             offset: self.offset,
         }
     }
+
+    fn info(&self) -> &FontInfo {
+        self.info.get_or_init(|| {
+            let font = self.as_ref();
+            FontInfo {
+                family: font
+                    .localized_strings()
+                    .find_by_id(StringId::Family, None)
+                    .map(|s| s.to_string())
+                    .unwrap_or_default(),
+                face: FaceKey::of(&font),
+                metrics: font.metrics(&[]),
+            }
+        })
+    }
+}
+
+/// The characters a font has glyphs for.
+///
+/// Stored as a bitset split into blocks of 256 characters,
+/// omitting blocks with no covered characters.
+#[derive(Default)]
+struct Coverage {
+    blocks: AHashMap<u32, [u64; 4]>,
+}
+
+impl Coverage {
+    fn of(font: &FontRef) -> Self {
+        let mut coverage = Self::default();
+        font.charmap().enumerate(|c, glyph| {
+            if glyph != 0 {
+                let block = coverage.blocks.entry(c >> 8).or_default();
+                block[(c as usize >> 6) & 3] |= 1 << (c & 63);
+            }
+        });
+        coverage
+    }
+
+    fn contains(&self, c: char) -> bool {
+        let c = c as u32;
+        match self.blocks.get(&(c >> 8)) {
+            Some(block) => block[(c as usize >> 6) & 3] & (1 << (c & 63)) != 0,
+            None => false,
+        }
+    }
 }
 
 #[derive(Copy, Clone, Debug, PartialEq, Eq, Hash, PartialOrd, Ord, Default)]
 pub struct FontId(usize);
 
+/// The weight and style of a font within its family.
+#[derive(Copy, Clone, Debug, PartialEq, Eq, Hash)]
+struct FaceKey {
+    weight: u16,
+    /// `None` for oblique fonts, which no query matches.
+    style: Option<Style>,
+}
+
+impl FaceKey {
+    fn of(font: &FontRef) -> Self {
+        let attributes = font.attributes();
+        let style = match attributes.style() {
+            swash::Style::Normal => Some(Style::Normal),
+            swash::Style::Italic => Some(Style::Italic),
+            swash::Style::Oblique(_) => None,
+        };
+        Self {
+            weight: attributes.weight().0,
+            style,
+        }
+    }
+
+    fn for_query(query: &Query) -> Self {
+        Self {
+            weight: swash::Weight::from(query.weight).0,
+            style: Some(query.style),
+        }
+    }
+}
+
+/// The fonts of one family, by weight and style.
+struct Family {
+    name: String,
+    faces: AHashMap<FaceKey, FontId>,
+}
+
+/// Maximum number of resolved queries to remember.
+const QUERY_CACHE_CAPACITY: usize = 64;
+
+/// A query result remembered by [`FontIndex`].
+struct CachedQuery {
+    /// The matching font, or the number of fonts that had been
+    /// added when no font matched. A failed query is retried once
+    /// more fonts are added.
+    result: Result<FontId, usize>,
+    /// Value of `FontIndex::clock` when the query was last made,
+    /// updated under the read lock to evict the least recently used query.
+    last_used: AtomicU64,
+}
+
+/// Index of fonts by family and face, built up
+/// as fonts are queried for the first time.
+#[derive(Default)]
+struct FontIndex {
+    /// Families in the order their first font was added.
+    families: Vec<Family>,
+    /// Number of fonts added to `families`.
+    indexed: usize,
+    queries: AHashMap<Query, CachedQuery>,
+    clock: AtomicU64,
+}
+
+impl FontIndex {
+    fn update(&mut self, fonts: &[Font]) {
+        for (i, font) in fonts.iter().enumerate().skip(self.indexed) {
+            let id = FontId(i);
+            let info = font.info();
+            log::info!("Loaded font '{}'", info.family);
+
+            let family = match self.families.iter().position(|f| f.name == info.family) {
+                Some(i) => &mut self.families[i],
+                None => {
+                    self.families.push(Family {
+                        name: info.family.clone(),
+                        faces: AHashMap::new(),
+                    });
+                    self.families.last_mut().unwrap()
+                }
+            };
+            // Earlier fonts take precedence.
+            family.faces.entry(info.face).or_insert(id);
+        }
+        self.indexed = fonts.len();
+    }
+
+    /// Looks up a remembered query result, returning `None` if
+    /// the query must be resolved again.
+    fn cached(&self, query: &Query, font_count: usize) -> Option<Result<FontId, ()>> {
+        let cached = self.queries.get(query)?;
+        let result = match cached.result {
+            Ok(id) => Ok(id),
+            Err(count) if count == font_count => Err(()),
+            Err(_) => return None,
+        };
+        cached.last_used.store(self.tick(), Ordering::Relaxed);
+        Some(result)
+    }
+
+    /// Remembers a query result, evicting the
+    /// least recently used query if the cache is full.
+    fn remember(&mut self, query: &Query, result: Result<FontId, usize>) {
+        if self.queries.len() >= QUERY_CACHE_CAPACITY && !self.queries.contains_key(query) {
+            let oldest = self
+                .queries
+                .iter()
+                .min_by_key(|(_, cached)| cached.last_used.load(Ordering::Relaxed))
+                .map(|(query, _)| query.clone());
+            if let Some(oldest) = oldest {
+                self.queries.remove(&oldest);
+            }
+        }
+        let last_used = AtomicU64::new(self.tick());
+        self.queries
+            .insert(query.clone(), CachedQuery { result, last_used });
+    }
+
+    fn tick(&self) -> u64 {
+        self.clock.fetch_add(1, Ordering::Relaxed)
+    }
+}
+
 /// The fonts available to a `Context`.
 #[derive(Default)]
 pub(crate) struct Fonts {
     fonts: Vec<Font>,
     default_family: Option<String>,
+    fallback_families: Vec<String>,
+    /// Read-locked for cached queries, write-locked to resolve new ones.
+    index: RwLock<FontIndex>,
 }
 
 impl Fonts {
+    /// Adds a font without parsing it. Cached query results stay valid,
+    /// since queries resolve to the earliest matching font. Cached failures
+    /// are retried, as they record how many fonts had been added.
     pub fn add(&mut self, font: Font) -> FontId {
         let id = FontId(self.fonts.len());
         self.fonts.push(font);
-        let name = self
-            .get(id)
-            .localized_strings()
-            .find_by_id(StringId::Family, None)
-            .expect("missing font family string");
-        log::info!("Loaded font '{}'", name);
         id
     }
 
@@ -180,16 +407,168 @@ impl Fonts {
         self.fonts[id.0].as_ref()
     }
 
+    pub fn family_name(&self, id: FontId) -> &str {
+        &self.fonts[id.0].info().family
+    }
+
+    /// Gets the metrics of a font, in font units.
+    pub fn metrics(&self, id: FontId) -> Metrics {
+        self.fonts[id.0].info().metrics
+    }
+
+    /// Returns whether the font has a glyph for `c`.
+    pub fn has_char(&self, id: FontId, c: char) -> bool {
+        let font = &self.fonts[id.0];
+        font.coverage
+            .get_or_init(|| Coverage::of(&font.as_ref()))
+            .contains(c)
+    }
+
     pub fn set_default_family(&mut self, family: String) {
         self.default_family = Some(family);
+        self.index.get_mut().queries.clear();
+    }
+
+    pub fn set_fallback_families(&mut self, families: Vec<String>) {
+        self.fallback_families = families;
     }
 
+    /// Resolves the fallback families for text styled with `query`, in order
+    /// of preference. Fonts with the queried weight and style are preferred,
+    /// then the normal face of the family.
+    pub fn fallbacks(&self, query: &Query) -> SmallVec<[FontId; 4]> {
+        let mut fallbacks = SmallVec::new();
+        for family in &self.fallback_families {
+            let exact = Query {
+                family: Some(family.as_str().into()),
+                ..query.clone()
+            };
+            let font = self
+                .query(&exact)
+                .or_else(|_| self.query(&Query::default().family(family)));
+            if let Ok(font) = font {
+                if !fallbacks.contains(&font) {
+                    fallbacks.push(font);
+                }
+            }
+        }
+        fallbacks
+    }
+
+    /// Finds the first added font whose family starts with the
+    /// queried family and whose weight and style match exactly.
     pub fn query(&self, query: &Query) -> Result<FontId, MissingFont> {
-        let i = self
-            .fonts
+        let cached = self.index.read().cached(query, self.fonts.len());
+        if let Some(result) = cached {
+            return result.map_err(|()| MissingFont(query.clone()));
+        }
+
+        let mut index = self.index.write();
+
+        if self.fonts.is_empty() {
+            return Err(MissingFont(query.clone()));
+        }
+        index.update(&self.fonts);
+
+        let family = query.family.as_deref().unwrap_or_else(|| {
+            self.default_family
+                .as_deref()
+                .expect("no default font family was set, but font::Query uses None as the family")
+        });
+        let face = FaceKey::for_query(query);
+        let id = index
+            .families
             .iter()
-            .position(|font| query.matches(&font.as_ref(), self.default_family.as_deref()));
+            .filter(|f| f.name.starts_with(family))
+            .filter_map(|f| f.faces.get(&face).copied())
+            .min();
+
+        index.remember(query, id.ok_or(self.fonts.len()));
+        id.ok_or_else(|| MissingFont(query.clone()))
+    }
+}
+
+/// Loads the fonts bundled in the repository, for tests.
+#[cfg(test)]
+pub(crate) fn test_fonts() -> Fonts {
+    let mut fonts = Fonts::default();
+    for data in [
+        &include_bytes!("../../../assets/ZenAntiqueSoft-Regular.ttf")[..],
+        &include_bytes!("../../../assets/Allison-Regular.ttf")[..],
+    ] {
+        for font in Font::load_all(&FontData::from(data)).unwrap() {
+            fonts.add(font);
+        }
+    }
+    fonts
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_coverage() {
+        let fonts = test_fonts();
+        for id in [FontId(0), FontId(1)] {
+            let charmap = fonts.get(id).charmap();
+            for c in (0..0x3100).filter_map(char::from_u32) {
+                assert_eq!(fonts.has_char(id, c), charmap.map(c) != 0, "{:?}", c);
+            }
+        }
+    }
+
+    #[test]
+    fn test_query() {
+        let mut fonts = test_fonts();
+        let zen = Query::default().family("Zen Antique Soft");
+        assert_eq!(fonts.query(&zen).ok(), Some(FontId(0)));
+        // Served from the query cache.
+        assert_eq!(fonts.query(&zen).ok(), Some(FontId(0)));
+        // Families match by prefix.
+        assert_eq!(
+            fonts.query(&Query::default().family("Zen")).ok(),
+            Some(FontId(0))
+        );
+
+        let other = fonts.family_name(FontId(1)).to_owned();
+        assert_eq!(
+            fonts.query(&Query::default().family(&other)).ok(),
+            Some(FontId(1))
+        );
+        assert!(fonts.query(&Query::default().family("Missing")).is_err());
+
+        fonts.set_default_family(other);
+        assert_eq!(fonts.query(&Query::default()).ok(), Some(FontId(1)));
+    }
+
+    #[test]
+    fn test_query_cache() {
+        let mut fonts = test_fonts();
+        let zen = Query::default().family("Zen Antique Soft");
+        let missing = Query::default().family("Missing");
+        assert!(fonts.query(&zen).is_ok());
+        assert!(fonts.query(&missing).is_err());
+
+        // Failed queries are remembered until another font is added.
+        let font_count = fonts.fonts.len();
+        assert_eq!(
+            fonts.index.get_mut().cached(&missing, font_count),
+            Some(Err(()))
+        );
+        assert_eq!(fonts.index.get_mut().cached(&missing, font_count + 1), None);
+
+        // A full cache evicts the least recently used query.
+        for i in 0..QUERY_CACHE_CAPACITY - 2 {
+            let query = Query::default().family(&format!("Missing {}", i));
+            assert!(fonts.query(&query).is_err());
+        }
+        assert!(fonts.query(&zen).is_ok());
+        assert!(fonts.query(&Query::default().family("Other")).is_err());
 
-        i.map(FontId).ok_or_else(|| MissingFont(query.clone()))
+        let queries = &fonts.index.get_mut().queries;
+        assert_eq!(queries.len(), QUERY_CACHE_CAPACITY);
+        assert!(queries.contains_key(&zen));
+        assert!(!queries.contains_key(&missing));
     }
 }
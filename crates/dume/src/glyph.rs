@@ -1,7 +1,20 @@
-use std::{sync::Arc, time::Duration};
+use std::{
+    cell::RefCell,
+    io, iter,
+    path::PathBuf,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc,
+    },
+    time::Duration,
+};
 
-use glam::{UVec2, Vec2};
+use ahash::{AHashMap, AHashSet};
+use glam::{uvec2, vec2, UVec2, Vec2};
+use instant::Instant;
 use lru::LruCache;
+#[cfg(not(target_arch = "wasm32"))]
+use rayon::prelude::*;
 use swash::{
     scale::{Render, ScaleContext, Source},
     zeno::{Format, Placement, Vector},
@@ -9,36 +22,175 @@ use swash::{
 };
 
 use crate::{
-    atlas::{DynamicTextureAtlas, TextureKey},
+    atlas::{AtlasEntry, DynamicTextureAtlas, TextureKey},
+    font::Fonts,
     Context, FontId,
 };
 
+pub use self::disk::hash_face;
+use self::disk::{DiskGlyph, StoredGlyph};
+
+mod disk;
+
+thread_local! {
+    static SCALE_CONTEXT: RefCell<ScaleContext> = RefCell::new(ScaleContext::new());
+}
+
 #[derive(Copy, Clone, Debug, PartialEq, Eq, Hash)]
-struct GlyphKey {
+pub struct GlyphKey {
     font: FontId,
     size: u32,              // 1/10s of a pixel
     subpixel_offset: UVec2, // in terms of glyph_subpixel_steps
     glyph_id: GlyphId,
+    /// Distance field glyphs are shared by all sizes,
+    /// so `size` and `subpixel_offset` are zero.
+    sdf: bool,
 }
 
 #[derive(Debug, Copy, Clone)]
 pub enum Glyph {
     Empty, // for unknown glyphs or glyphs with size 0
     InAtlas(TextureKey, Placement),
+    /// A signed distance field rasterized at `SDF_SIZE`,
+    /// which can be drawn at any size.
+    Sdf(TextureKey, Placement),
+}
+
+/// Size in pixels at which distance field glyphs are rasterized.
+pub const SDF_SIZE: f32 = 48.;
+/// Distance in pixels at `SDF_SIZE` covered by a distance field,
+/// on each side of the glyph outline.
+pub const SDF_SPREAD: u32 = 6;
+
+/// Maximum number of glyphs moved in the atlas per frame by compaction.
+const COMPACTION_MOVES_PER_FRAME: usize = 256;
+
+/// Glyphs at or above this size are drawn as distance fields,
+/// since their bitmaps may not fit in an atlas page.
+const MAX_BITMAP_GLYPH_SIZE: f32 = 1024.;
+
+impl Glyph {
+    /// Number of pixels the glyph occupies in the atlas.
+    fn area(&self) -> usize {
+        match self {
+            Glyph::Empty => 0,
+            Glyph::InAtlas(_, placement) | Glyph::Sdf(_, placement) => {
+                (placement.width * placement.height) as usize
+            }
+        }
+    }
+}
+
+/// How glyph edges are antialiased.
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum GlyphAntialiasing {
+    /// Coverage is computed separately for the red, green, and blue
+    /// subpixels of horizontal RGB displays, giving sharper text.
+    /// Glyphs are stored in an `Rgba8Unorm` atlas.
+    Subpixel,
+    /// A single coverage value per pixel. Looks better than subpixel
+    /// antialiasing on HiDPI displays and for rotated or transparent
+    /// text, and stores glyphs in an `R8Unorm` atlas using a quarter
+    /// of the memory and upload bandwidth.
+    Grayscale,
+}
+
+impl Default for GlyphAntialiasing {
+    fn default() -> Self {
+        GlyphAntialiasing::Subpixel
+    }
+}
+
+impl GlyphAntialiasing {
+    fn texture_format(self) -> wgpu::TextureFormat {
+        match self {
+            GlyphAntialiasing::Subpixel => wgpu::TextureFormat::Rgba8Unorm,
+            GlyphAntialiasing::Grayscale => wgpu::TextureFormat::R8Unorm,
+        }
+    }
+
+    fn render_format(self) -> Format {
+        match self {
+            GlyphAntialiasing::Subpixel => Format::CustomSubpixel([0.3, 0., -0.3]),
+            GlyphAntialiasing::Grayscale => Format::Alpha,
+        }
+    }
+
+    /// Bytes per pixel of glyph bitmaps and the atlas.
+    fn bytes_per_pixel(self) -> usize {
+        match self {
+            GlyphAntialiasing::Subpixel => 4,
+            GlyphAntialiasing::Grayscale => 1,
+        }
+    }
+}
+
+#[derive(Debug)]
+struct CachedGlyph {
+    glyph: Glyph,
+    /// Usage is recorded through shared references, so
+    /// that lookups only need a read lock on the cache.
+    last_used_frame: AtomicU64,
+    /// Start of the frame the glyph was last used in,
+    /// in milliseconds since the cache's `epoch`.
+    last_used_millis: AtomicU64,
+    /// Frame in which the glyph's LRU position was last updated.
+    /// Lookups don't reorder the LRU list, so it is brought up
+    /// to date lazily in `end_frame`.
+    ordered_frame: u64,
+}
+
+impl CachedGlyph {
+    fn mark_used(&self, frame: u64, millis: u64) {
+        self.last_used_frame.store(frame, Ordering::Relaxed);
+        self.last_used_millis.store(millis, Ordering::Relaxed);
+    }
 }
 
 /// A cache of rasterized glyphs stored in a texture atlas.
 ///
 /// Each glyph is uniquely identified by a [`GlyphKey`], which includes
 /// the font, size, and subpixel offset of the glyph.
+///
+/// Glyphs are evicted in [`end_frame`](Self::end_frame) once they
+/// have gone unused for `glyph_expire_duration`, or, if a byte budget
+/// is set, in least-recently-used order while the budget is exceeded.
+///
+/// The context keeps the cache behind a read-write lock. Lookups of
+/// cached glyphs only need `&self`, so threads drawing text
+/// concurrently contend for the write lock only on misses.
 pub(crate) struct GlyphCache {
     atlas: DynamicTextureAtlas,
-    cache: LruCache<GlyphKey, Glyph>,
-
-    scale_context: ScaleContext,
+    /// Ordered by last use, so the least recently used glyph
+    /// is always the next candidate for eviction.
+    cache: LruCache<GlyphKey, CachedGlyph>,
 
     glyph_subpixel_steps: UVec2,
+    antialiasing: GlyphAntialiasing,
     glyph_expire_duration: Duration,
+    byte_budget: Option<usize>,
+
+    /// Whether misses are rasterized by [`rasterize_in_background`]
+    /// rather than in `glyph_or_rasterize`.
+    background_rasterization: bool,
+    /// Glyphs queued for background rasterization.
+    pending: AHashSet<GlyphKey>,
+
+    /// Physical size above which glyphs are drawn as distance fields.
+    sdf_min_size: Option<f32>,
+    /// Fonts whose glyphs are always drawn as distance fields.
+    sdf_fonts: AHashSet<FontId>,
+
+    disk_cache: Option<DiskCache>,
+
+    /// Total size of the glyphs in the atlas.
+    used_bytes: usize,
+    /// See [`generation`](Self::generation).
+    generation: u64,
+    frame: u64,
+    epoch: Instant,
+    /// Start of the current frame in milliseconds since `epoch`.
+    frame_start_millis: u64,
 }
 
 impl GlyphCache {
@@ -51,15 +203,34 @@ impl GlyphCache {
             atlas: DynamicTextureAtlas::new(
                 Arc::clone(device),
                 Arc::clone(queue),
-                wgpu::TextureFormat::Rgba8Unorm,
+                settings.glyph_antialiasing.texture_format(),
                 "glyph_atlas",
+                settings.glyph_atlas_pages,
             ),
             cache: LruCache::unbounded(), // glyphs are expired manually
 
-            scale_context: ScaleContext::new(),
-
             glyph_subpixel_steps: settings.glyph_subpixel_steps,
+            antialiasing: settings.glyph_antialiasing,
             glyph_expire_duration: settings.glyph_expire_duration,
+            byte_budget: settings.glyph_cache_budget,
+
+            background_rasterization: settings.async_glyph_rasterization
+                && cfg!(not(target_arch = "wasm32")),
+            pending: AHashSet::new(),
+
+            sdf_min_size: settings.sdf_glyph_min_size,
+            sdf_fonts: AHashSet::new(),
+
+            disk_cache: settings
+                .glyph_disk_cache
+                .as_ref()
+                .map(|path| DiskCache::open(path.clone(), settings)),
+
+            used_bytes: 0,
+            generation: 0,
+            frame: 0,
+            epoch: Instant::now(),
+            frame_start_millis: 0,
         }
     }
 
@@ -67,6 +238,94 @@ impl GlyphCache {
         &self.atlas
     }
 
+    /// Uploads the glyphs rasterized since the last call to the GPU.
+    /// Must be called before rendering glyphs from the cache.
+    pub fn flush_uploads(&mut self) {
+        self.atlas.flush_uploads();
+    }
+
+    pub fn key(&self, font: FontId, glyph_id: GlyphId, size: f32, position: Vec2) -> GlyphKey {
+        if self.uses_sdf(font, size) {
+            return GlyphKey {
+                font,
+                size: 0,
+                subpixel_offset: UVec2::ZERO,
+                glyph_id,
+                sdf: true,
+            };
+        }
+
+        let subpixel_offset = (position.fract() * self.glyph_subpixel_steps.as_vec2()).as_uvec2();
+        GlyphKey {
+            font,
+            size: (size * 10.) as u32,
+            subpixel_offset,
+            glyph_id,
+            sdf: false,
+        }
+    }
+
+    fn uses_sdf(&self, font: FontId, size: f32) -> bool {
+        self.sdf_fonts.contains(&font)
+            || size >= MAX_BITMAP_GLYPH_SIZE
+            || matches!(self.sdf_min_size, Some(min) if size >= min)
+    }
+
+    /// Draws all glyphs of a font as distance fields.
+    pub fn enable_sdf_for_font(&mut self, font: FontId) {
+        self.sdf_fonts.insert(font);
+    }
+
+    /// Looks up a cached glyph, marking it as used.
+    fn get(&self, key: &GlyphKey) -> Option<Glyph> {
+        let cached = self.cache.peek(key)?;
+        cached.mark_used(self.frame, self.frame_start_millis);
+        Some(cached.glyph)
+    }
+
+    /// Looks up a cached glyph without rasterizing it. With background
+    /// rasterization, a glyph still being rasterized is replaced
+    /// by a variant with a different subpixel offset if possible.
+    ///
+    /// Returns `None` if the glyph must be rasterized
+    /// with [`glyph_or_rasterize`](Self::glyph_or_rasterize).
+    pub fn lookup(&self, key: &GlyphKey) -> Option<Glyph> {
+        match self.get(key) {
+            Some(glyph) => Some(glyph),
+            None if self.background_rasterization => {
+                Some(self.subpixel_variant(key).unwrap_or(Glyph::Empty))
+            }
+            None => None,
+        }
+    }
+
+    /// Marks glyphs as used without looking up their placements,
+    /// for callers that reuse placements from an earlier frame.
+    pub fn mark_used(&self, keys: &[GlyphKey]) {
+        for key in keys {
+            self.get(key);
+        }
+    }
+
+    /// Gets the atlas position of a glyph.
+    pub fn atlas_entry(&self, glyph: &Glyph) -> Option<AtlasEntry> {
+        match glyph {
+            Glyph::Empty => None,
+            Glyph::InAtlas(key, _) | Glyph::Sdf(key, _) => Some(self.atlas.get(*key)),
+        }
+    }
+
+    /// Changes whenever a glyph is added or removed, or the atlas is
+    /// repacked. Glyphs and atlas positions looked up in the same
+    /// generation remain valid.
+    pub fn generation(&self) -> u64 {
+        self.generation
+    }
+
+    /// Gets a glyph, rasterizing it if it is not cached.
+    ///
+    /// With background rasterization, a miss instead returns a cached
+    /// variant with a different subpixel offset, or `Glyph::Empty`.
     pub fn glyph_or_rasterize(
         &mut self,
         cx: &Context,
@@ -75,55 +334,490 @@ impl GlyphCache {
         size: f32,
         position: Vec2,
     ) -> Glyph {
-        let subpixel_offset = (position.fract() * self.glyph_subpixel_steps.as_vec2()).as_uvec2();
-        let key = GlyphKey {
-            font,
-            size: (size * 10.) as u32,
-            subpixel_offset,
-            glyph_id,
+        let request = GlyphRequest {
+            key: self.key(font, glyph_id, size, position),
+            size,
+            offset: position.x.fract(),
+            antialiasing: self.antialiasing,
         };
-
-        match self.cache.get(&key) {
-            Some(g) => *g,
+        match self.get(&request.key) {
+            Some(glyph) => glyph,
+            None if self.background_rasterization => {
+                self.subpixel_variant(&request.key).unwrap_or(Glyph::Empty)
+            }
             None => {
-                // Rasterize the glyph and write it to the atlas.
-                // NB: color bitmaps can't be supported yet because the atlas is alpha-only.
-                let mut render = Render::new(&[Source::Outline]);
-                render
-                    .offset(Vector::new(position.x.fract(), 0.))
-                    .format(Format::CustomSubpixel([0.3, 0., -0.3]));
-
-                let fonts = cx.fonts();
-                let font = fonts.get(font);
-
-                let mut scaler = self
-                    .scale_context
-                    .builder(font)
-                    .hint(true)
-                    .size(size)
-                    .build();
-
-                let image = render.render(&mut scaler, glyph_id);
-
-                let glyph = match image {
-                    Some(image) => {
-                        if image.placement.width == 0 || image.placement.height == 0 {
-                            Glyph::Empty
-                        } else {
-                            let key = self.atlas.insert(
-                                &image.data,
-                                image.placement.width,
-                                image.placement.height,
-                            );
-                            Glyph::InAtlas(key, image.placement)
-                        }
-                    }
-                    None => Glyph::Empty,
+                let bitmap = rasterize(&cx.fonts(), &request);
+                self.insert(request.key, bitmap)
+            }
+        }
+    }
+
+    /// Finds a cached variant of a glyph with a different subpixel offset.
+    fn subpixel_variant(&self, key: &GlyphKey) -> Option<Glyph> {
+        let steps = self.glyph_subpixel_steps;
+        (0..steps.x)
+            .flat_map(|x| (0..steps.y).map(move |y| uvec2(x, y)))
+            .find_map(|subpixel_offset| {
+                let variant = GlyphKey {
+                    subpixel_offset,
+                    ..*key
                 };
+                self.cache.peek(&variant).map(|cached| cached.glyph)
+            })
+    }
 
-                self.cache.put(key, glyph);
-                self.cache.get(&key).copied().unwrap()
+    pub fn rasterizes_in_background(&self) -> bool {
+        self.background_rasterization
+    }
+
+    /// Marks glyphs as queued for background rasterization,
+    /// so that [`missing_glyphs`](Self::missing_glyphs) skips them.
+    pub fn mark_pending(&mut self, requests: &[GlyphRequest]) {
+        self.pending
+            .extend(requests.iter().map(|request| request.key));
+    }
+
+    /// Filters glyphs given as `(font, glyph, size, position)`
+    /// down to those not yet in the cache or pending, without duplicates.
+    pub fn missing_glyphs(
+        &self,
+        glyphs: impl IntoIterator<Item = (FontId, GlyphId, f32, Vec2)>,
+    ) -> Vec<GlyphRequest> {
+        let mut seen = AHashSet::new();
+        glyphs
+            .into_iter()
+            .filter_map(|(font, glyph_id, size, position)| {
+                let key = self.key(font, glyph_id, size, position);
+                if self.cache.contains(&key) || self.pending.contains(&key) || !seen.insert(key) {
+                    return None;
+                }
+                Some(GlyphRequest {
+                    key,
+                    size,
+                    offset: position.x.fract(),
+                    antialiasing: self.antialiasing,
+                })
+            })
+            .collect()
+    }
+
+    /// Lists the glyphs missing from the cache among all combinations of
+    /// the given glyphs and sizes, at every subpixel offset if `subpixel_variants`
+    /// is set, or else only at offset zero.
+    pub fn prewarm_requests(
+        &self,
+        font: FontId,
+        glyph_ids: &[GlyphId],
+        sizes: &[f32],
+        subpixel_variants: bool,
+    ) -> Vec<GlyphRequest> {
+        let steps = if subpixel_variants {
+            self.glyph_subpixel_steps
+        } else {
+            UVec2::ONE
+        };
+        // Sample the middle of each subpixel bucket.
+        let offsets = (0..steps.x).flat_map(|x| {
+            (0..steps.y).map(move |y| (vec2(x as f32, y as f32) + 0.5) / steps.as_vec2())
+        });
+        let glyphs = offsets.flat_map(|offset| {
+            sizes.iter().flat_map(move |&size| {
+                glyph_ids
+                    .iter()
+                    .map(move |&glyph_id| (font, glyph_id, size, offset))
+            })
+        });
+        self.missing_glyphs(glyphs)
+    }
+
+    /// Inserts glyphs rasterized with [`rasterize_all`] into the atlas,
+    /// returning the number of bytes of atlas space used.
+    pub fn insert_rasterized(&mut self, glyphs: Vec<RasterizedGlyph>) -> usize {
+        let mut bytes = 0;
+        for glyph in glyphs {
+            self.pending.remove(&glyph.key);
+            // Another thread may have rasterized the glyph in the meantime.
+            if !self.cache.contains(&glyph.key) {
+                let glyph = self.insert(glyph.key, glyph.bitmap);
+                bytes += self.glyph_bytes(&glyph);
+            }
+        }
+        bytes
+    }
+
+    /// Number of bytes a glyph occupies in the atlas.
+    fn glyph_bytes(&self, glyph: &Glyph) -> usize {
+        glyph.area() * self.antialiasing.bytes_per_pixel()
+    }
+
+    fn insert(&mut self, key: GlyphKey, bitmap: StoredGlyph) -> Glyph {
+        let placement = bitmap.placement;
+        let glyph = if placement.width == 0 || placement.height == 0 || bitmap.data.is_empty() {
+            Glyph::Empty
+        } else {
+            match self.insert_bitmap(&bitmap) {
+                Some(atlas_key) if key.sdf => Glyph::Sdf(atlas_key, placement),
+                Some(atlas_key) => Glyph::InAtlas(atlas_key, placement),
+                None => {
+                    // Not cached, so the glyph is rasterized again when next drawn.
+                    log::warn!("No room for glyph in the glyph atlas");
+                    return Glyph::Empty;
+                }
+            }
+        };
+
+        self.used_bytes += self.glyph_bytes(&glyph);
+        self.generation += 1;
+        self.cache.put(
+            key,
+            CachedGlyph {
+                glyph,
+                last_used_frame: AtomicU64::new(self.frame),
+                last_used_millis: AtomicU64::new(self.frame_start_millis),
+                ordered_frame: self.frame,
+            },
+        );
+        glyph
+    }
+
+    /// Inserts a bitmap into the atlas. If the atlas is full, glyphs
+    /// not used during the current frame are evicted to make room.
+    fn insert_bitmap(&mut self, bitmap: &StoredGlyph) -> Option<TextureKey> {
+        let Placement { width, height, .. } = bitmap.placement;
+        loop {
+            if let Some(atlas_key) = self.atlas.insert(&bitmap.data, width, height) {
+                return Some(atlas_key);
+            }
+            if !DynamicTextureAtlas::fits_in_page(width, height) {
+                return None;
+            }
+            match self.peek_lru() {
+                Some((_, last_used_frame)) if last_used_frame < self.frame => self.evict_lru(),
+                _ => return None,
+            }
+        }
+    }
+
+    /// Gets the least recently used glyph and the frame it was last used in.
+    fn peek_lru(&mut self) -> Option<(GlyphKey, u64)> {
+        while let Some((&key, cached)) = self.cache.peek_lru() {
+            let last_used_frame = cached.last_used_frame.load(Ordering::Relaxed);
+            if last_used_frame > cached.ordered_frame {
+                // Used since it was last ordered; move it to the front.
+                if let Some(cached) = self.cache.get_mut(&key) {
+                    cached.ordered_frame = last_used_frame;
+                }
+                continue;
+            }
+            return Some((key, last_used_frame));
+        }
+        None
+    }
+
+    fn evict_lru(&mut self) {
+        if let Some((_, cached)) = self.cache.pop_lru() {
+            self.used_bytes -= self.glyph_bytes(&cached.glyph);
+            if let Glyph::InAtlas(key, _) | Glyph::Sdf(key, _) = cached.glyph {
+                self.atlas.remove(key);
+            }
+            self.generation += 1;
+        }
+    }
+
+    /// Uploads glyphs for a newly added font from the disk cache.
+    pub fn load_font_from_disk(&mut self, font: FontId, font_hash: u64) {
+        let glyphs = match &mut self.disk_cache {
+            Some(disk_cache) => {
+                disk_cache.font_hashes.insert(font, font_hash);
+                disk_cache.unclaimed.remove(&font_hash).unwrap_or_default()
+            }
+            None => return,
+        };
+
+        let count = glyphs.len();
+        for glyph in glyphs {
+            let key = glyph.key(font);
+            if !self.cache.contains(&key) {
+                self.insert(key, glyph.glyph);
+            }
+        }
+        log::info!("Loaded {} glyphs from the disk cache", count);
+    }
+
+    /// Writes all cached glyphs to the disk cache file, if enabled.
+    /// Glyphs loaded from the file for fonts not added in this
+    /// session are kept.
+    ///
+    /// Bitmaps are not kept in memory after upload, so they are read
+    /// back from the atlas. Glyphs without pixels are cheap to rasterize
+    /// and are not written.
+    pub fn save_to_disk(&mut self) -> io::Result<()> {
+        let disk_cache = match &self.disk_cache {
+            Some(d) => d,
+            None => return Ok(()),
+        };
+
+        let cached: Vec<(u64, GlyphKey, Placement, TextureKey)> = self
+            .cache
+            .iter()
+            .filter_map(|(key, cached)| {
+                let font_hash = *disk_cache.font_hashes.get(&key.font)?;
+                match cached.glyph {
+                    Glyph::InAtlas(texture, placement) | Glyph::Sdf(texture, placement) => {
+                        Some((font_hash, *key, placement, texture))
+                    }
+                    Glyph::Empty => None,
+                }
+            })
+            .collect();
+        let textures: Vec<TextureKey> = cached.iter().map(|&(.., texture)| texture).collect();
+        let bitmaps = self
+            .atlas
+            .read_textures(&textures)
+            .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?;
+        let stored: Vec<(u64, GlyphKey, StoredGlyph)> = cached
+            .into_iter()
+            .zip(bitmaps)
+            .map(|((font_hash, key, placement, _), data)| {
+                (font_hash, key, StoredGlyph { placement, data })
+            })
+            .collect();
+
+        let glyphs: Vec<(u64, GlyphKey, &StoredGlyph)> = stored
+            .iter()
+            .map(|(font_hash, key, glyph)| (*font_hash, *key, glyph))
+            .chain(
+                disk_cache
+                    .unclaimed
+                    .iter()
+                    .flat_map(|(&font_hash, glyphs)| {
+                        glyphs.iter().map(move |glyph| {
+                            // The font ID is not written.
+                            (font_hash, glyph.key(FontId::default()), &glyph.glyph)
+                        })
+                    }),
+            )
+            .collect();
+        disk::write(&disk_cache.path, disk_cache.format, glyphs.into_iter())
+    }
+
+    /// Called by [`Context::end_frame`](crate::Context::end_frame) once per
+    /// application frame, while no batches are being recorded. Evicts glyphs
+    /// that have expired or that exceed the byte budget, then compacts the
+    /// atlas if it has become sparse.
+    ///
+    /// Glyphs used during the frame that just ended are not evicted to meet
+    /// the budget, since they are likely to be drawn again.
+    pub fn end_frame(&mut self) {
+        self.frame += 1;
+        self.frame_start_millis = self.epoch.elapsed().as_millis() as u64;
+
+        while let Some((key, last_used_frame)) = self.peek_lru() {
+            let cached = self.cache.peek(&key).expect("missing LRU glyph");
+            let unused_millis = self
+                .frame_start_millis
+                .saturating_sub(cached.last_used_millis.load(Ordering::Relaxed));
+            let expired = Duration::from_millis(unused_millis) >= self.glyph_expire_duration;
+            let over_budget = match self.byte_budget {
+                Some(budget) => self.used_bytes > budget && last_used_frame + 1 < self.frame,
+                None => false,
+            };
+            if !expired && !over_budget {
+                break;
+            }
+            self.evict_lru();
+        }
+
+        // No batch holds atlas positions between frames, and cached
+        // placements are dropped on a generation change.
+        if self.atlas.compact_step(COMPACTION_MOVES_PER_FRAME) {
+            self.generation += 1;
+        }
+    }
+}
+
+/// Glyphs persisted across runs.
+struct DiskCache {
+    path: PathBuf,
+    format: disk::Format,
+    /// Glyphs read from the file whose fonts have not been added yet,
+    /// keyed by font face hash.
+    unclaimed: AHashMap<u64, Vec<DiskGlyph>>,
+    font_hashes: AHashMap<FontId, u64>,
+}
+
+impl DiskCache {
+    fn open(path: PathBuf, settings: &crate::context::Settings) -> Self {
+        let format = disk::Format {
+            bytes_per_pixel: settings.glyph_antialiasing.bytes_per_pixel() as u32,
+            subpixel_steps: settings.glyph_subpixel_steps,
+        };
+
+        let mut unclaimed: AHashMap<u64, Vec<DiskGlyph>> = AHashMap::new();
+        match disk::read(&path, format) {
+            Ok(glyphs) => {
+                for (font_hash, glyph) in glyphs {
+                    unclaimed.entry(font_hash).or_default().push(glyph);
+                }
+            }
+            Err(e) if e.kind() == io::ErrorKind::NotFound => {}
+            Err(e) => log::warn!("Ignoring glyph cache file {}: {}", path.display(), e),
+        }
+
+        Self {
+            path,
+            format,
+            unclaimed,
+            font_hashes: AHashMap::new(),
+        }
+    }
+}
+
+/// A glyph missing from the cache.
+#[derive(Copy, Clone, Debug)]
+pub struct GlyphRequest {
+    key: GlyphKey,
+    size: f32,
+    /// Horizontal subpixel offset
+    offset: f32,
+    antialiasing: GlyphAntialiasing,
+}
+
+/// A glyph bitmap ready to be inserted into the atlas.
+pub struct RasterizedGlyph {
+    key: GlyphKey,
+    bitmap: StoredGlyph,
+}
+
+/// Rasterizes glyphs in parallel. This does not need
+/// the glyph cache, so it should be called without holding its lock.
+pub fn rasterize_all(fonts: &Fonts, requests: &[GlyphRequest]) -> Vec<RasterizedGlyph> {
+    let rasterize = |request: &GlyphRequest| RasterizedGlyph {
+        key: request.key,
+        bitmap: rasterize(fonts, request),
+    };
+
+    #[cfg(not(target_arch = "wasm32"))]
+    {
+        requests.par_iter().map(rasterize).collect()
+    }
+    // No threads on the web.
+    #[cfg(target_arch = "wasm32")]
+    {
+        requests.iter().map(rasterize).collect()
+    }
+}
+
+/// Rasterizes glyphs on the rayon thread pool, inserting them into
+/// the cache when done and then invoking the context's glyph callback.
+///
+/// The requests should first be passed to [`GlyphCache::mark_pending`].
+#[cfg(not(target_arch = "wasm32"))]
+pub fn rasterize_in_background(cx: Context, requests: Vec<GlyphRequest>) {
+    rayon::spawn(move || {
+        let rasterized = rasterize_all(&cx.fonts(), &requests);
+        cx.glyph_cache().insert_rasterized(rasterized);
+        if let Some(on_ready) = cx.on_glyphs_ready() {
+            on_ready();
+        }
+    });
+}
+
+fn rasterize(fonts: &Fonts, request: &GlyphRequest) -> StoredGlyph {
+    if request.key.sdf {
+        return rasterize_sdf(fonts, request);
+    }
+
+    // NB: color bitmaps can't be supported yet because the atlas is alpha-only.
+    let mut render = Render::new(&[Source::Outline]);
+    render
+        .offset(Vector::new(request.offset, 0.))
+        .format(request.antialiasing.render_format());
+
+    let image = SCALE_CONTEXT.with(|scale_context| {
+        let mut scale_context = scale_context.borrow_mut();
+        let mut scaler = scale_context
+            .builder(fonts.get(request.key.font))
+            .hint(true)
+            .size(request.size)
+            .build();
+        render.render(&mut scaler, request.key.glyph_id)
+    });
+
+    match image {
+        Some(image) => StoredGlyph {
+            placement: image.placement,
+            data: image.data,
+        },
+        None => StoredGlyph::empty(),
+    }
+}
+
+/// Rasterizes a glyph as a signed distance field. Each texel stores
+/// the distance to the outline, mapped so that 0.5 lies on the outline,
+/// 1 is `SDF_SPREAD` pixels inside, and 0 is `SDF_SPREAD` pixels outside.
+fn rasterize_sdf(fonts: &Fonts, request: &GlyphRequest) -> StoredGlyph {
+    let mut render = Render::new(&[Source::Outline]);
+    render.format(Format::Alpha);
+
+    let image = SCALE_CONTEXT.with(|scale_context| {
+        let mut scale_context = scale_context.borrow_mut();
+        let mut scaler = scale_context
+            .builder(fonts.get(request.key.font))
+            .hint(false)
+            .size(SDF_SIZE)
+            .build();
+        render.render(&mut scaler, request.key.glyph_id)
+    });
+    let image = match image {
+        Some(image) if image.placement.width > 0 && image.placement.height > 0 => image,
+        _ => return StoredGlyph::empty(),
+    };
+
+    let spread = SDF_SPREAD as i32;
+    let width = image.placement.width as i32;
+    let height = image.placement.height as i32;
+    let inside = |x: i32, y: i32| {
+        x >= 0 && y >= 0 && x < width && y < height && image.data[(y * width + x) as usize] >= 128
+    };
+
+    // The field extends `spread` pixels beyond the glyph bitmap on each side.
+    let field_width = width + 2 * spread;
+    let field_height = height + 2 * spread;
+    let bytes_per_pixel = request.antialiasing.bytes_per_pixel();
+    let mut data = Vec::with_capacity((field_width * field_height) as usize * bytes_per_pixel);
+    for y in -spread..height + spread {
+        for x in -spread..width + spread {
+            let is_inside = inside(x, y);
+
+            // Brute-force search for the nearest pixel on the other side of the outline.
+            let mut nearest_squared = (spread * spread + 1) as f32;
+            for dy in -spread..=spread {
+                for dx in -spread..=spread {
+                    if inside(x + dx, y + dy) != is_inside {
+                        nearest_squared = nearest_squared.min((dx * dx + dy * dy) as f32);
+                    }
+                }
+            }
+
+            // The outline lies halfway between the two pixel centers.
+            let mut distance = nearest_squared.sqrt() - 0.5;
+            if !is_inside {
+                distance = -distance;
             }
+            let value = (0.5 + distance / (2. * spread as f32)).clamp(0., 1.);
+            let value = (value * 255.).round() as u8;
+            data.extend(iter::repeat(value).take(bytes_per_pixel));
         }
     }
+
+    StoredGlyph {
+        placement: Placement {
+            left: image.placement.left - spread,
+            top: image.placement.top + spread,
+            width: field_width as u32,
+            height: field_height as u32,
+        },
+        data,
+    }
 }
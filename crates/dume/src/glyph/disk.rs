@@ -0,0 +1,321 @@
+//! On-disk storage for rasterized glyphs, so that they
+//! need not be rasterized again each time the application starts.
+//!
+//! The file starts with a header:
+//! * the magic bytes `DUMEGLYF`
+//! * `u32` format version
+//! * `u32` bytes per pixel of the glyph bitmaps
+//! * `u32` x 2 glyph subpixel steps
+//! * `u32` record count
+//!
+//! followed by a flat list of records, each holding the font face hash (`u64`),
+//! the `GlyphKey` fields, the glyph placement, and the bitmap. All integers are
+//! little-endian. A file written with different settings is ignored.
+
+use std::{
+    fs::{self, File},
+    io::{self, BufWriter, Write},
+    path::Path,
+};
+
+use glam::{uvec2, UVec2};
+use swash::{zeno::Placement, FontRef, GlyphId};
+
+use super::GlyphKey;
+use crate::FontId;
+
+const MAGIC: &[u8; 8] = b"DUMEGLYF";
+const VERSION: u32 = 3;
+/// Length of a record with an empty bitmap: the font hash
+/// and ten `u32` fields.
+const MIN_RECORD_LEN: usize = 8 + 10 * 4;
+
+/// A glyph bitmap as stored on disk.
+/// `data` is empty for glyphs with no pixels.
+pub struct StoredGlyph {
+    pub placement: Placement,
+    pub data: Vec<u8>,
+}
+
+impl StoredGlyph {
+    pub fn empty() -> Self {
+        Self {
+            placement: Placement {
+                left: 0,
+                top: 0,
+                width: 0,
+                height: 0,
+            },
+            data: Vec::new(),
+        }
+    }
+}
+
+/// A glyph read from disk, keyed by font content
+/// rather than by `FontId`.
+pub struct DiskGlyph {
+    pub size: u32,
+    pub subpixel_offset: UVec2,
+    pub glyph_id: GlyphId,
+    pub sdf: bool,
+    pub glyph: StoredGlyph,
+}
+
+impl DiskGlyph {
+    pub(super) fn key(&self, font: FontId) -> GlyphKey {
+        GlyphKey {
+            font,
+            size: self.size,
+            subpixel_offset: self.subpixel_offset,
+            glyph_id: self.glyph_id,
+            sdf: self.sdf,
+        }
+    }
+}
+
+/// Settings that must match for a file to be usable.
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub struct Format {
+    pub bytes_per_pixel: u32,
+    pub subpixel_steps: UVec2,
+}
+
+/// Identifies a font face across runs without hashing the whole file.
+///
+/// Hashes the file length, the face's offset within it, and the face's
+/// `head` and `name` tables. `head` holds a checksum of the whole file
+/// and its modification date. This is 64-bit FNV-1a, which unlike our
+/// hash maps' hasher is stable between processes.
+pub fn hash_face(font: FontRef) -> u64 {
+    let mut hash = fnv1a(
+        0xcbf2_9ce4_8422_2325,
+        &(font.data.len() as u64).to_le_bytes(),
+    );
+    hash = fnv1a(hash, &font.offset.to_le_bytes());
+    for tag in [b"head", b"name"] {
+        let table = font.table(swash::tag_from_bytes(tag)).unwrap_or_default();
+        hash = fnv1a(hash, &(table.len() as u64).to_le_bytes());
+        hash = fnv1a(hash, table);
+    }
+    hash
+}
+
+fn fnv1a(hash: u64, data: &[u8]) -> u64 {
+    data.iter().fold(hash, |hash, &byte| {
+        (hash ^ byte as u64).wrapping_mul(0x0100_0000_01b3)
+    })
+}
+
+/// Reads all glyphs in the file, returning them
+/// along with the hash of their font faces.
+pub fn read(path: &Path, format: Format) -> io::Result<Vec<(u64, DiskGlyph)>> {
+    let bytes = fs::read(path)?;
+    let mut reader = Reader(&bytes);
+
+    if reader.bytes(MAGIC.len())? != MAGIC || reader.u32()? != VERSION {
+        return Err(invalid_data("not a glyph cache file"));
+    }
+    let file_format = Format {
+        bytes_per_pixel: reader.u32()?,
+        subpixel_steps: uvec2(reader.u32()?, reader.u32()?),
+    };
+    if file_format != format {
+        return Err(invalid_data("glyph cache file has different settings"));
+    }
+
+    let count = reader.u32()?;
+    // The count is not trusted; a truncated file fails before growing too far.
+    let mut glyphs = Vec::with_capacity((count as usize).min(reader.0.len() / MIN_RECORD_LEN));
+    for _ in 0..count {
+        let font_hash = reader.u64()?;
+        let size = reader.u32()?;
+        let subpixel_offset = uvec2(reader.u32()?, reader.u32()?);
+        let glyph_id = reader.u32()? as GlyphId;
+        let sdf = reader.u32()? != 0;
+        let placement = Placement {
+            left: reader.u32()? as i32,
+            top: reader.u32()? as i32,
+            width: reader.u32()?,
+            height: reader.u32()?,
+        };
+        let len = reader.u32()? as usize;
+        let expected_len = (placement.width as usize)
+            .checked_mul(placement.height as usize)
+            .and_then(|area| area.checked_mul(format.bytes_per_pixel as usize));
+        if len != 0 && Some(len) != expected_len {
+            return Err(invalid_data("glyph bitmap has wrong size"));
+        }
+        let data = reader.bytes(len)?.to_vec();
+
+        glyphs.push((
+            font_hash,
+            DiskGlyph {
+                size,
+                subpixel_offset,
+                glyph_id,
+                sdf,
+                glyph: StoredGlyph { placement, data },
+            },
+        ));
+    }
+    Ok(glyphs)
+}
+
+/// Writes glyphs to the file, replacing it atomically.
+pub(super) fn write<'a>(
+    path: &Path,
+    format: Format,
+    glyphs: impl ExactSizeIterator<Item = (u64, GlyphKey, &'a StoredGlyph)>,
+) -> io::Result<()> {
+    let temp_path = path.with_extension("tmp");
+    let mut writer = BufWriter::new(File::create(&temp_path)?);
+
+    writer.write_all(MAGIC)?;
+    for value in [
+        VERSION,
+        format.bytes_per_pixel,
+        format.subpixel_steps.x,
+        format.subpixel_steps.y,
+        glyphs.len() as u32,
+    ] {
+        writer.write_all(&value.to_le_bytes())?;
+    }
+
+    for (font_hash, key, glyph) in glyphs {
+        writer.write_all(&font_hash.to_le_bytes())?;
+        for value in [
+            key.size,
+            key.subpixel_offset.x,
+            key.subpixel_offset.y,
+            key.glyph_id as u32,
+            key.sdf as u32,
+            glyph.placement.left as u32,
+            glyph.placement.top as u32,
+            glyph.placement.width,
+            glyph.placement.height,
+            glyph.data.len() as u32,
+        ] {
+            writer.write_all(&value.to_le_bytes())?;
+        }
+        writer.write_all(&glyph.data)?;
+    }
+
+    writer.into_inner()?.sync_all()?;
+    fs::rename(temp_path, path)
+}
+
+fn invalid_data(message: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, message)
+}
+
+struct Reader<'a>(&'a [u8]);
+
+impl<'a> Reader<'a> {
+    fn bytes(&mut self, len: usize) -> io::Result<&'a [u8]> {
+        if self.0.len() < len {
+            return Err(invalid_data("glyph cache file is truncated"));
+        }
+        let (bytes, rest) = self.0.split_at(len);
+        self.0 = rest;
+        Ok(bytes)
+    }
+
+    fn u32(&mut self) -> io::Result<u32> {
+        Ok(u32::from_le_bytes(self.bytes(4)?.try_into().unwrap()))
+    }
+
+    fn u64(&mut self) -> io::Result<u64> {
+        Ok(u64::from_le_bytes(self.bytes(8)?.try_into().unwrap()))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const FORMAT: Format = Format {
+        bytes_per_pixel: 1,
+        subpixel_steps: UVec2::new(4, 1),
+    };
+
+    fn temp_path(name: &str) -> std::path::PathBuf {
+        std::env::temp_dir().join(format!("dume-{}-{}", name, std::process::id()))
+    }
+
+    fn header(count: u32) -> Vec<u8> {
+        let mut bytes = MAGIC.to_vec();
+        for value in [VERSION, 1, 4, 1, count] {
+            bytes.extend_from_slice(&value.to_le_bytes());
+        }
+        bytes
+    }
+
+    #[test]
+    fn test_round_trip() {
+        let key = GlyphKey {
+            font: FontId::default(),
+            size: 120,
+            subpixel_offset: uvec2(3, 0),
+            glyph_id: 42,
+            sdf: false,
+        };
+        let glyph = StoredGlyph {
+            placement: Placement {
+                left: -1,
+                top: 9,
+                width: 2,
+                height: 3,
+            },
+            data: vec![1, 2, 3, 4, 5, 6],
+        };
+        let empty = StoredGlyph::empty();
+        let path = temp_path("round-trip");
+        write(
+            &path,
+            FORMAT,
+            [(7, key, &glyph), (8, key, &empty)].into_iter(),
+        )
+        .unwrap();
+
+        let glyphs = read(&path, FORMAT).unwrap();
+        fs::remove_file(&path).unwrap();
+        assert_eq!(glyphs.len(), 2);
+        let (font_hash, read_glyph) = &glyphs[0];
+        assert_eq!(*font_hash, 7);
+        assert_eq!(read_glyph.key(FontId::default()), key);
+        assert_eq!(read_glyph.glyph.placement, glyph.placement);
+        assert_eq!(read_glyph.glyph.data, glyph.data);
+        assert_eq!(glyphs[1].0, 8);
+        assert!(glyphs[1].1.glyph.data.is_empty());
+
+        let other_format = Format {
+            bytes_per_pixel: 4,
+            ..FORMAT
+        };
+        let path = temp_path("other-format");
+        write(&path, FORMAT, std::iter::empty()).unwrap();
+        assert!(read(&path, other_format).is_err());
+        fs::remove_file(&path).unwrap();
+    }
+
+    #[test]
+    fn test_read_rejects_bad_lengths() {
+        // A huge record count in a file with no records.
+        let path = temp_path("huge-count");
+        fs::write(&path, header(u32::MAX)).unwrap();
+        assert!(read(&path, FORMAT).is_err());
+        fs::remove_file(&path).unwrap();
+
+        // A bitmap whose area wraps around to its length in `u32` arithmetic.
+        let mut bytes = header(1);
+        bytes.extend_from_slice(&0u64.to_le_bytes());
+        for value in [0, 0, 0, 1, 0, 0, 0, 0x10000, 0x10001, 0x10000] {
+            bytes.extend_from_slice(&u32::to_le_bytes(value));
+        }
+        bytes.resize(bytes.len() + 0x10000, 0);
+        let path = temp_path("overflow");
+        fs::write(&path, bytes).unwrap();
+        assert!(read(&path, FORMAT).is_err());
+        fs::remove_file(&path).unwrap();
+    }
+}
@@ -4,12 +4,49 @@ use glam::{uvec2, UVec2};
 
 use crate::Context;
 
+/// The pixel format of layers, which hold rendered pixels
+/// before they are blitted onto the target surface.
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum IntermediateFormat {
+    /// 8-bit sRGB colors packed into an `R32Uint` texture.
+    ///
+    /// Every render to a layer decodes and re-encodes sRGB
+    /// for each pixel, which loses precision when compositing
+    /// several passes onto the same layer.
+    Srgb8,
+    /// Linear colors stored in an `Rgba16Float` texture.
+    ///
+    /// Colors are sRGB-encoded only once, when the layer is blitted.
+    /// Uses twice the memory of `Srgb8`. Requires an adapter that
+    /// supports read-write storage access to `Rgba16Float` textures
+    /// (`Features::TEXTURE_ADAPTER_SPECIFIC_FORMAT_FEATURES`).
+    LinearF16,
+}
+
+impl Default for IntermediateFormat {
+    fn default() -> Self {
+        IntermediateFormat::Srgb8
+    }
+}
+
+impl IntermediateFormat {
+    pub(crate) fn texture_format(self) -> wgpu::TextureFormat {
+        match self {
+            // NB: the data stored in these textures is sRGB, but we handle
+            // the sRGB conversions ourselves.
+            IntermediateFormat::Srgb8 => wgpu::TextureFormat::R32Uint,
+            IntermediateFormat::LinearF16 => wgpu::TextureFormat::Rgba16Float,
+        }
+    }
+}
+
 /// A layer of rendered pixels.
 ///
 /// You can draw to a layer through [`Canvas::render_to_layer`].
 pub struct Layer {
     context: Context,
-    texture: wgpu::TextureView,
+    texture: wgpu::Texture,
+    texture_view: wgpu::TextureView,
     desc: wgpu::TextureDescriptor<'static>,
 }
 
@@ -26,16 +63,17 @@ impl Layer {
             mip_level_count: 1,
             sample_count: 1,
             dimension: wgpu::TextureDimension::D2,
-            format: crate::INTERMEDIATE_FORMAT,
-            usage: wgpu::TextureUsages::TEXTURE_BINDING | wgpu::TextureUsages::STORAGE_BINDING,
+            format: context.settings().intermediate_format.texture_format(),
+            usage: wgpu::TextureUsages::TEXTURE_BINDING
+                | wgpu::TextureUsages::STORAGE_BINDING
+                | wgpu::TextureUsages::COPY_SRC
+                | wgpu::TextureUsages::COPY_DST,
         };
-        let texture = context
-            .device()
-            .create_texture(&desc)
-            .create_view(&Default::default());
+        let texture = context.device().create_texture(&desc);
 
         Self {
             context,
+            texture_view: texture.create_view(&Default::default()),
             texture,
             desc,
         }
@@ -50,23 +88,36 @@ impl Layer {
     ///
     /// The given texture must be of format `TARGET_FORMAT`
     /// and have `TextureUsages::RENDER_ATTACHMENT`.
+    ///
+    /// If the context is not [ready](crate::Context::is_ready),
+    /// the target is cleared to black instead.
     pub fn blit_onto(&self, target: &wgpu::TextureView) {
-        let prepared_blit = self.context.renderer().prepare_blit(
-            &self.context,
-            &self.texture,
-            self.physical_size(),
-        );
         let mut encoder = self
             .context
             .device()
             .create_command_encoder(&Default::default());
+        if !self.context.is_ready() {
+            self.context.renderer().clear(&mut encoder, target);
+            self.context.queue().submit(iter::once(encoder.finish()));
+            return;
+        }
+
+        let prepared_blit = self.context.renderer().prepare_blit(
+            &self.context,
+            &self.texture_view,
+            self.physical_size(),
+        );
         self.context
             .renderer()
             .blit(&mut encoder, prepared_blit, target, None);
         self.context.queue().submit(iter::once(encoder.finish()));
     }
 
-    pub(crate) fn texture(&self) -> &wgpu::TextureView {
+    pub(crate) fn texture(&self) -> &wgpu::Texture {
         &self.texture
     }
+
+    pub(crate) fn texture_view(&self) -> &wgpu::TextureView {
+        &self.texture_view
+    }
 }
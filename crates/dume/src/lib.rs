@@ -14,25 +14,24 @@ mod layer;
 mod rect;
 mod renderer;
 mod scissor;
+mod shader;
 mod text;
 mod texture;
 pub mod yuv;
 
-// NB: the data stored in these textures is sRGB, but we handle
-// the sRGB conversions ourselves.
-const INTERMEDIATE_FORMAT: wgpu::TextureFormat = wgpu::TextureFormat::R32Uint;
 pub const TARGET_FORMAT: wgpu::TextureFormat = wgpu::TextureFormat::Bgra8Unorm;
 
 pub use canvas::Canvas;
-pub use context::Context;
-pub use font::{FontId, Style, Weight};
-pub use layer::Layer;
+pub use context::{Context, ContextBuilder, GlyphPrewarmStats, StartupStats};
+pub use font::{FontData, FontId, Style, Weight};
+pub use glyph::GlyphAntialiasing;
+pub use layer::{IntermediateFormat, Layer};
 pub use rect::Rect;
 pub use renderer::StrokeCap;
 pub use scissor::Scissor;
 use smartstring::LazyCompact;
 pub use text::{
-    layout::{Align, Baseline, TextBlob, TextOptions},
+    layout::{Align, Baseline, ShapeCacheStats, TextBlob, TextOptions},
     Text, TextSection, TextStyle,
 };
 pub use texture::{MissingTexture, TextureId, TextureSet, TextureSetBuilder, TextureSetId};
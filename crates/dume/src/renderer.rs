@@ -1,19 +1,51 @@
-use std::{mem::size_of, num::NonZeroU64};
+use std::{
+    mem::{self, size_of},
+    num::NonZeroU64,
+    sync::Arc,
+    time::Duration,
+};
 
+use ahash::AHashMap;
 use bytemuck::{Pod, Zeroable};
 use glam::{uvec2, vec2, Affine2, UVec2, Vec2};
+use instant::Instant;
+use once_cell::sync::OnceCell;
 use palette::Srgba;
-use wgpu::util::DeviceExt;
+use parking_lot::Mutex;
+use wgpu::util::{DeviceExt, StagingBelt};
 
 use crate::{
+    atlas::dynamic::MAX_PAGES as MAX_GLYPH_ATLAS_PAGES,
+    context::Settings,
+    glyph,
     scissor::{PackedScissor, Scissor},
-    Context, Rect, SpriteRotate, TextureSetId, INTERMEDIATE_FORMAT, TARGET_FORMAT,
+    shader::{self, ShaderDefines},
+    Context, GlyphAntialiasing, IntermediateFormat, Layer, Rect, SpriteRotate, TextureSetId,
+    TARGET_FORMAT,
 };
 
-// Must match definitions in render.wgsl.
+// Substituted into render.wgsl.
 const TILE_WORKGROUP_SIZE: u32 = 256;
 const SORT_WORKGROUP_SIZE: u32 = 16;
-const TILE_SIZE: u32 = 16;
+/// Maximum side length of the paint kernel's workgroup.
+const MAX_PAINT_WORKGROUP_SIZE: u32 = 16;
+
+/// Size of each chunk allocated by the staging belt
+/// used to upload batches.
+const STAGING_CHUNK_SIZE: u64 = 256 * 1024;
+
+/// Binding of a glyph atlas page in render.wgsl. Page 0 is at binding 7,
+/// and the other pages follow the last fixed binding.
+fn glyph_atlas_binding(page: usize) -> u32 {
+    match page {
+        0 => 7,
+        page => 10 + page as u32,
+    }
+}
+
+/// Initial value of a tile counter for tiles that should
+/// keep their existing contents and not be painted this frame.
+const TILE_CLEAN: u32 = 0x8000_0000;
 
 const SHAPE_FILL_RECT: i32 = 0;
 const SHAPE_STROKE_RECT: i32 = 1;
@@ -27,6 +59,59 @@ const PAINT_TYPE_LINEAR_GRADIENT: i32 = 1;
 const PAINT_TYPE_RADIAL_GRADIENT: i32 = 2;
 const PAINT_TYPE_GLYPH: i32 = 3;
 const PAINT_TYPE_TEXTURE: i32 = 4;
+const PAINT_TYPE_SDF_GLYPH: i32 = 5;
+
+const RENDER_SHADER: &str = include_str!("../shaders/render.wgsl");
+
+/// The set of shapes and paint types used in a batch.
+///
+/// A variant of the paint kernel is compiled for each distinct
+/// set, leaving out the branches for unused features.
+#[derive(Copy, Clone, Debug, PartialEq, Eq, Hash, Default)]
+struct PaintFeatures(u32);
+
+impl PaintFeatures {
+    const RECT: u32 = 1 << 0;
+    const CIRCLE: u32 = 1 << 1;
+    const STROKE_PATH: u32 = 1 << 2;
+    const FILL_PATH: u32 = 1 << 3;
+    const SOLID: u32 = 1 << 4;
+    const LINEAR_GRADIENT: u32 = 1 << 5;
+    const RADIAL_GRADIENT: u32 = 1 << 6;
+    const GLYPH: u32 = 1 << 7;
+    const TEXTURE: u32 = 1 << 8;
+    const SCISSOR: u32 = 1 << 9;
+    const SDF_GLYPH: u32 = 1 << 10;
+
+    const ALL: PaintFeatures = PaintFeatures((1 << 11) - 1);
+
+    /// The render.wgsl flag enabled by each feature.
+    const FLAGS: [(u32, &'static str); 11] = [
+        (Self::RECT, "HAS_RECT"),
+        (Self::CIRCLE, "HAS_CIRCLE"),
+        (Self::STROKE_PATH, "HAS_STROKE_PATH"),
+        (Self::FILL_PATH, "HAS_FILL_PATH"),
+        (Self::SOLID, "HAS_SOLID"),
+        (Self::LINEAR_GRADIENT, "HAS_LINEAR_GRADIENT"),
+        (Self::RADIAL_GRADIENT, "HAS_RADIAL_GRADIENT"),
+        (Self::GLYPH, "HAS_GLYPH"),
+        (Self::TEXTURE, "HAS_TEXTURE"),
+        (Self::SCISSOR, "HAS_SCISSOR"),
+        (Self::SDF_GLYPH, "HAS_SDF_GLYPH"),
+    ];
+
+    fn insert(&mut self, feature: u32) {
+        self.0 |= feature;
+    }
+
+    fn apply(self, defines: ShaderDefines) -> ShaderDefines {
+        Self::FLAGS
+            .iter()
+            .fold(defines, |defines, &(feature, flag)| {
+                defines.flag_if(flag, self.0 & feature != 0)
+            })
+    }
+}
 
 #[derive(Copy, Clone, Debug, PartialEq, Eq)]
 pub enum StrokeCap {
@@ -39,14 +124,32 @@ pub enum StrokeCap {
 /// One `Renderer` exists per `Context`.
 /// To draw onto a canvas, create a `Batch`.
 pub struct Renderer {
-    pipelines: Pipelines,
+    /// Initialized once shaders are compiled, which may
+    /// happen on a background thread.
+    pipelines: Arc<OnceCell<Pipelines>>,
     empty_texture: wgpu::TextureView,
+    /// Intermediate texture for scroll copies, grown to
+    /// the largest scrolled region seen so far.
+    scroll_scratch: Mutex<Option<ScrollScratch>>,
+
+    tile_size: u32,
+    tile_capacity: u32,
 }
 
 impl Renderer {
-    pub fn new(device: &wgpu::Device) -> Self {
+    /// Creates a renderer. If `background` is set, pipelines are compiled
+    /// on a separate thread, and [`is_ready`](Self::is_ready) returns `false`
+    /// until they are available.
+    pub fn new(device: &Arc<wgpu::Device>, settings: &Settings, background: bool) -> Self {
+        let pipelines = Arc::new(OnceCell::new());
+        if background {
+            compile_in_background(Arc::clone(device), settings.clone(), Arc::clone(&pipelines));
+        } else {
+            pipelines.get_or_init(|| Pipelines::new(device, settings));
+        }
+
         Self {
-            pipelines: Pipelines::new(device),
+            pipelines,
             empty_texture: device
                 .create_texture(&wgpu::TextureDescriptor {
                     label: Some("empty_texture"),
@@ -62,7 +165,48 @@ impl Renderer {
                     usage: wgpu::TextureUsages::TEXTURE_BINDING,
                 })
                 .create_view(&Default::default()),
+            scroll_scratch: Mutex::new(None),
+
+            tile_size: settings.tile_size,
+            tile_capacity: settings.tile_capacity,
+        }
+    }
+
+    /// Returns whether pipelines are compiled and the renderer can draw.
+    pub fn is_ready(&self) -> bool {
+        self.pipelines.get().is_some()
+    }
+
+    /// Gets the time spent compiling pipelines, or `None` if
+    /// they are still being compiled.
+    pub fn pipeline_compile_time(&self) -> Option<Duration> {
+        self.pipelines.get().map(|pipelines| pipelines.compile_time)
+    }
+
+    /// Gets the paint kernel specialized for `features`.
+    ///
+    /// Variants are compiled in the background on first use,
+    /// and the kernel with all features is used until they are ready.
+    fn paint_pipeline(
+        &self,
+        device: &Arc<wgpu::Device>,
+        features: PaintFeatures,
+    ) -> Arc<wgpu::ComputePipeline> {
+        let (pipeline, needs_compile) = self.pipelines().paint_pipeline(features);
+        if needs_compile {
+            compile_paint_pipeline_in_background(
+                Arc::clone(device),
+                Arc::clone(&self.pipelines),
+                features,
+            );
         }
+        pipeline
+    }
+
+    fn pipelines(&self) -> &Pipelines {
+        self.pipelines
+            .get()
+            .expect("renderer used before pipelines were compiled")
     }
 
     pub fn create_batch(&self, physical_size: UVec2, scale_factor: f32) -> Batch {
@@ -70,6 +214,10 @@ impl Renderer {
             scale_factor,
             physical_size,
             logical_size: physical_size.as_vec2() / scale_factor,
+            tile_size: self.tile_size,
+            tile_capacity: self.tile_capacity,
+
+            features: PaintFeatures::default(),
 
             nodes: Vec::new(),
             node_bounding_boxes: Vec::new(),
@@ -77,14 +225,45 @@ impl Renderer {
             scissors: Vec::new(),
 
             texture_set: None,
+
+            scrolls: Vec::new(),
+            damage: None,
         }
     }
 
+    /// Creates the set of reusable GPU buffers a canvas uploads its batches into.
+    pub fn create_render_buffers(&self, device: &wgpu::Device) -> RenderBuffers {
+        RenderBuffers {
+            belt: StagingBelt::new(STAGING_CHUNK_SIZE),
+            globals: GrowableBuffer::new(device, "globals", wgpu::BufferUsages::UNIFORM),
+            nodes: GrowableBuffer::new(device, "nodes", wgpu::BufferUsages::STORAGE),
+            node_bounding_boxes: GrowableBuffer::new(
+                device,
+                "node_bounding_boxes",
+                wgpu::BufferUsages::STORAGE,
+            ),
+            points: GrowableBuffer::new(device, "points", wgpu::BufferUsages::STORAGE),
+            scissors: GrowableBuffer::new(device, "scissors", wgpu::BufferUsages::STORAGE),
+            tile_nodes: GrowableBuffer::new(device, "tile_nodes", wgpu::BufferUsages::STORAGE),
+            tile_counters: GrowableBuffer::new(
+                device,
+                "tile_counters",
+                wgpu::BufferUsages::STORAGE,
+            ),
+        }
+    }
+
+    /// Prepares a batch for rendering, encoding the upload of its
+    /// data into `buffers` on `encoder`.
+    ///
+    /// The caller must submit `encoder` and then call [`RenderBuffers::recall`].
     pub fn prepare_render(
         &self,
-        mut batch: Batch,
+        batch: &mut Batch,
         context: &Context,
         target_texture: &wgpu::TextureView,
+        buffers: &mut RenderBuffers,
+        encoder: &mut wgpu::CommandEncoder,
     ) -> PreparedRender {
         if batch.points.is_empty() {
             batch.points.push(0);
@@ -95,47 +274,45 @@ impl Renderer {
 
         let device = context.device();
 
-        let glyphs = context.glyph_cache();
-        let glyph_atlas = glyphs.atlas().texture_view();
-
-        let globals = batch.globals();
-        let globals = device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
-            label: None,
-            contents: bytemuck::bytes_of(&globals),
-            usage: wgpu::BufferUsages::UNIFORM,
-        });
-        let nodes = device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
-            label: None,
-            contents: bytemuck::cast_slice(&batch.nodes),
-            usage: wgpu::BufferUsages::STORAGE,
-        });
-        let node_bounding_boxes = device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
-            label: None,
-            contents: bytemuck::cast_slice(&batch.node_bounding_boxes),
-            usage: wgpu::BufferUsages::STORAGE,
-        });
-        let tile_nodes = device.create_buffer(&wgpu::BufferDescriptor {
-            label: None,
-            size: batch.tile_buffer_size(),
-            usage: wgpu::BufferUsages::STORAGE,
-            mapped_at_creation: false,
-        });
-        let tile_counters = device.create_buffer(&wgpu::BufferDescriptor {
-            label: None,
-            size: batch.tile_counters_buffer_size(),
-            usage: wgpu::BufferUsages::STORAGE,
-            mapped_at_creation: false,
-        });
-        let points = device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
-            label: None,
-            contents: bytemuck::cast_slice(&batch.points),
-            usage: wgpu::BufferUsages::STORAGE,
-        });
-        let scissors = device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
-            label: None,
-            contents: bytemuck::cast_slice(&batch.scissors),
-            usage: wgpu::BufferUsages::STORAGE,
-        });
+        let glyphs = context.glyph_cache_read();
+        let glyph_atlas = glyphs.atlas();
+
+        let RenderBuffers {
+            belt,
+            globals,
+            nodes,
+            node_bounding_boxes,
+            points,
+            scissors,
+            tile_nodes,
+            tile_counters,
+        } = buffers;
+        globals.write(device, encoder, belt, bytemuck::bytes_of(&batch.globals()));
+        nodes.write(device, encoder, belt, bytemuck::cast_slice(&batch.nodes));
+        node_bounding_boxes.write(
+            device,
+            encoder,
+            belt,
+            bytemuck::cast_slice(&batch.node_bounding_boxes),
+        );
+        points.write(device, encoder, belt, bytemuck::cast_slice(&batch.points));
+        scissors.write(device, encoder, belt, bytemuck::cast_slice(&batch.scissors));
+
+        // Tile nodes are written by the shader before they are read,
+        // so they can keep the previous frame's contents.
+        tile_nodes.reserve(device, batch.tile_buffer_size());
+        let tile_counters_size = batch.tile_counters_buffer_size();
+        if batch.has_damage() {
+            tile_counters.write_with(device, encoder, belt, tile_counters_size, |bytes| {
+                batch.write_tile_mask(bytemuck::cast_slice_mut(bytes))
+            });
+        } else {
+            tile_counters.reserve(device, tile_counters_size);
+            if let Some(size) = NonZeroU64::new(tile_counters_size) {
+                encoder.clear_buffer(&tile_counters.buffer, 0, Some(size));
+            }
+        }
+        belt.finish();
 
         let textures = context.textures();
         let texture_atlas = match batch.texture_set {
@@ -143,97 +320,164 @@ impl Renderer {
             None => &self.empty_texture,
         };
 
+        let mut entries = vec![
+            wgpu::BindGroupEntry {
+                binding: 0,
+                resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
+                    buffer: &globals.buffer,
+                    offset: 0,
+                    size: None,
+                }),
+            },
+            wgpu::BindGroupEntry {
+                binding: 1,
+                resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
+                    buffer: &nodes.buffer,
+                    offset: 0,
+                    size: None,
+                }),
+            },
+            wgpu::BindGroupEntry {
+                binding: 2,
+                resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
+                    buffer: &node_bounding_boxes.buffer,
+                    offset: 0,
+                    size: None,
+                }),
+            },
+            wgpu::BindGroupEntry {
+                binding: 3,
+                resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
+                    buffer: &tile_nodes.buffer,
+                    offset: 0,
+                    size: None,
+                }),
+            },
+            wgpu::BindGroupEntry {
+                binding: 4,
+                resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
+                    buffer: &tile_counters.buffer,
+                    offset: 0,
+                    size: None,
+                }),
+            },
+            wgpu::BindGroupEntry {
+                binding: 5,
+                resource: wgpu::BindingResource::TextureView(target_texture),
+            },
+            wgpu::BindGroupEntry {
+                binding: 6,
+                resource: wgpu::BindingResource::Sampler(&self.pipelines().linear_sampler),
+            },
+            wgpu::BindGroupEntry {
+                binding: 8,
+                resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
+                    buffer: &points.buffer,
+                    offset: 0,
+                    size: None,
+                }),
+            },
+            wgpu::BindGroupEntry {
+                binding: 9,
+                resource: wgpu::BindingResource::TextureView(texture_atlas),
+            },
+            wgpu::BindGroupEntry {
+                binding: 10,
+                resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
+                    buffer: &scissors.buffer,
+                    offset: 0,
+                    size: None,
+                }),
+            },
+        ];
+        // Pages that do not exist are bound to an empty texture.
+        entries.extend((0..MAX_GLYPH_ATLAS_PAGES).map(|page| wgpu::BindGroupEntry {
+            binding: glyph_atlas_binding(page),
+            resource: wgpu::BindingResource::TextureView(
+                glyph_atlas.page_view(page).unwrap_or(&self.empty_texture),
+            ),
+        }));
+
         let bind_group = device.create_bind_group(&wgpu::BindGroupDescriptor {
             label: None,
-            layout: &self.pipelines.render_bg_layout,
-            entries: &[
-                wgpu::BindGroupEntry {
-                    binding: 0,
-                    resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
-                        buffer: &globals,
-                        offset: 0,
-                        size: None,
-                    }),
-                },
-                wgpu::BindGroupEntry {
-                    binding: 1,
-                    resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
-                        buffer: &nodes,
-                        offset: 0,
-                        size: None,
-                    }),
-                },
-                wgpu::BindGroupEntry {
-                    binding: 2,
-                    resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
-                        buffer: &node_bounding_boxes,
-                        offset: 0,
-                        size: None,
-                    }),
-                },
-                wgpu::BindGroupEntry {
-                    binding: 3,
-                    resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
-                        buffer: &tile_nodes,
-                        offset: 0,
-                        size: None,
-                    }),
-                },
-                wgpu::BindGroupEntry {
-                    binding: 4,
-                    resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
-                        buffer: &tile_counters,
-                        offset: 0,
-                        size: None,
-                    }),
-                },
-                wgpu::BindGroupEntry {
-                    binding: 5,
-                    resource: wgpu::BindingResource::TextureView(target_texture),
-                },
-                wgpu::BindGroupEntry {
-                    binding: 6,
-                    resource: wgpu::BindingResource::Sampler(&self.pipelines.linear_sampler),
-                },
-                wgpu::BindGroupEntry {
-                    binding: 7,
-                    resource: wgpu::BindingResource::TextureView(glyph_atlas),
-                },
-                wgpu::BindGroupEntry {
-                    binding: 8,
-                    resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
-                        buffer: &points,
-                        offset: 0,
-                        size: None,
-                    }),
-                },
-                wgpu::BindGroupEntry {
-                    binding: 9,
-                    resource: wgpu::BindingResource::TextureView(texture_atlas),
-                },
-                wgpu::BindGroupEntry {
-                    binding: 10,
-                    resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
-                        buffer: &scissors,
-                        offset: 0,
-                        size: None,
-                    }),
-                },
-            ],
+            layout: &self.pipelines().render_bg_layout,
+            entries: &entries,
         });
 
         PreparedRender {
+            paint_pipeline: self.paint_pipeline(device, batch.features),
             bind_group,
             tile_count: batch.tile_count(),
             node_count: batch.nodes.len() as u32,
         }
     }
 
+    /// Shifts the pixels of a layer according to the scroll hints
+    /// recorded in a batch. Must be encoded before the batch's render.
+    pub fn scroll_layer(
+        &self,
+        context: &Context,
+        encoder: &mut wgpu::CommandEncoder,
+        layer: &Layer,
+        scrolls: &[ScrollCopy],
+    ) {
+        let mut scroll_scratch = self.scroll_scratch.lock();
+        for scroll in scrolls {
+            // Copies within a single texture may not overlap,
+            // so we go through a scratch texture.
+            let size = wgpu::Extent3d {
+                width: scroll.size.x,
+                height: scroll.size.y,
+                depth_or_array_layers: 1,
+            };
+            let scratch = ScrollScratch::get(&mut scroll_scratch, context, scroll.size);
+
+            encoder.copy_texture_to_texture(
+                wgpu::ImageCopyTexture {
+                    texture: layer.texture(),
+                    mip_level: 0,
+                    origin: wgpu::Origin3d {
+                        x: scroll.src.x,
+                        y: scroll.src.y,
+                        z: 0,
+                    },
+                    aspect: wgpu::TextureAspect::All,
+                },
+                wgpu::ImageCopyTexture {
+                    texture: &scratch.texture,
+                    mip_level: 0,
+                    origin: wgpu::Origin3d::ZERO,
+                    aspect: wgpu::TextureAspect::All,
+                },
+                size,
+            );
+            encoder.copy_texture_to_texture(
+                wgpu::ImageCopyTexture {
+                    texture: &scratch.texture,
+                    mip_level: 0,
+                    origin: wgpu::Origin3d::ZERO,
+                    aspect: wgpu::TextureAspect::All,
+                },
+                wgpu::ImageCopyTexture {
+                    texture: layer.texture(),
+                    mip_level: 0,
+                    origin: wgpu::Origin3d {
+                        x: scroll.dst.x,
+                        y: scroll.dst.y,
+                        z: 0,
+                    },
+                    aspect: wgpu::TextureAspect::All,
+                },
+                size,
+            );
+        }
+    }
+
     pub fn render(&self, prepared: PreparedRender, encoder: &mut wgpu::CommandEncoder) {
         let mut pass = encoder.begin_compute_pass(&wgpu::ComputePassDescriptor::default());
 
         // Tiles
-        pass.set_pipeline(&self.pipelines.tile_pipeline);
+        pass.set_pipeline(&self.pipelines().tile_pipeline);
         pass.set_bind_group(0, &prepared.bind_group, &[]);
         pass.dispatch_workgroups(
             (prepared.node_count + TILE_WORKGROUP_SIZE - 1) / TILE_WORKGROUP_SIZE,
@@ -242,7 +486,7 @@ impl Renderer {
         );
 
         // Sort
-        pass.set_pipeline(&self.pipelines.sort_pipeline);
+        pass.set_pipeline(&self.pipelines().sort_pipeline);
         pass.set_bind_group(0, &prepared.bind_group, &[]);
         pass.dispatch_workgroups(
             (prepared.tile_count.x + SORT_WORKGROUP_SIZE - 1) / SORT_WORKGROUP_SIZE,
@@ -251,7 +495,7 @@ impl Renderer {
         );
 
         // Paint
-        pass.set_pipeline(&self.pipelines.paint_pipeline);
+        pass.set_pipeline(&prepared.paint_pipeline);
         pass.set_bind_group(0, &prepared.bind_group, &[]);
         pass.dispatch_workgroups(prepared.tile_count.x, prepared.tile_count.y, 1);
     }
@@ -270,7 +514,7 @@ impl Renderer {
         });
         let bind_group = device.create_bind_group(&wgpu::BindGroupDescriptor {
             label: None,
-            layout: &self.pipelines.blit_bg_layout,
+            layout: &self.pipelines().blit_bg_layout,
             entries: &[
                 wgpu::BindGroupEntry {
                     binding: 0,
@@ -278,7 +522,7 @@ impl Renderer {
                 },
                 wgpu::BindGroupEntry {
                     binding: 1,
-                    resource: wgpu::BindingResource::Sampler(&self.pipelines.nearest_sampler),
+                    resource: wgpu::BindingResource::Sampler(&self.pipelines().nearest_sampler),
                 },
                 wgpu::BindGroupEntry {
                     binding: 2,
@@ -293,6 +537,23 @@ impl Renderer {
         PreparedBlit { bind_group }
     }
 
+    /// Clears `target` to black. Used in place of a blit
+    /// until pipelines are compiled.
+    pub fn clear(&self, encoder: &mut wgpu::CommandEncoder, target: &wgpu::TextureView) {
+        encoder.begin_render_pass(&wgpu::RenderPassDescriptor {
+            label: None,
+            color_attachments: &[Some(wgpu::RenderPassColorAttachment {
+                view: target,
+                resolve_target: None,
+                ops: wgpu::Operations {
+                    load: wgpu::LoadOp::Clear(wgpu::Color::BLACK),
+                    store: true,
+                },
+            })],
+            depth_stencil_attachment: None,
+        });
+    }
+
     pub fn blit(
         &self,
         encoder: &mut wgpu::CommandEncoder,
@@ -322,139 +583,222 @@ impl Renderer {
                 scissor.size.y.ceil() as u32,
             );
         }
-        pass.set_pipeline(&self.pipelines.blit_pipeline);
+        pass.set_pipeline(&self.pipelines().blit_pipeline);
         pass.set_bind_group(0, &prepared.bind_group, &[]);
         pass.draw(0..3, 0..1);
     }
 }
 
+#[cfg(not(target_arch = "wasm32"))]
+fn compile_in_background(
+    device: Arc<wgpu::Device>,
+    settings: Settings,
+    pipelines: Arc<OnceCell<Pipelines>>,
+) {
+    std::thread::Builder::new()
+        .name("dume-pipelines".to_owned())
+        .spawn(move || {
+            pipelines.get_or_init(|| Pipelines::new(&device, &settings));
+        })
+        .expect("failed to spawn pipeline compilation thread");
+}
+
+/// Threads are not available on the web, so we compile immediately.
+#[cfg(target_arch = "wasm32")]
+fn compile_in_background(
+    device: Arc<wgpu::Device>,
+    settings: Settings,
+    pipelines: Arc<OnceCell<Pipelines>>,
+) {
+    pipelines.get_or_init(|| Pipelines::new(&device, &settings));
+}
+
+#[cfg(not(target_arch = "wasm32"))]
+fn compile_paint_pipeline_in_background(
+    device: Arc<wgpu::Device>,
+    pipelines: Arc<OnceCell<Pipelines>>,
+    features: PaintFeatures,
+) {
+    std::thread::Builder::new()
+        .name("dume-pipelines".to_owned())
+        .spawn(move || {
+            if let Some(pipelines) = pipelines.get() {
+                pipelines.compile_paint_pipeline(&device, features);
+            }
+        })
+        .expect("failed to spawn pipeline compilation thread");
+}
+
+#[cfg(target_arch = "wasm32")]
+fn compile_paint_pipeline_in_background(
+    device: Arc<wgpu::Device>,
+    pipelines: Arc<OnceCell<Pipelines>>,
+    features: PaintFeatures,
+) {
+    if let Some(pipelines) = pipelines.get() {
+        pipelines.compile_paint_pipeline(&device, features);
+    }
+}
+
 struct Pipelines {
     tile_pipeline: wgpu::ComputePipeline,
     sort_pipeline: wgpu::ComputePipeline,
-    paint_pipeline: wgpu::ComputePipeline,
     render_bg_layout: wgpu::BindGroupLayout,
+    render_pipeline_layout: wgpu::PipelineLayout,
+    /// Defines shared by all variants of render.wgsl.
+    render_defines: ShaderDefines,
+    /// The paint kernel with all features, used while variants compile.
+    full_paint_pipeline: Arc<wgpu::ComputePipeline>,
+    /// Paint kernel variants, compiled on first use.
+    /// `None` marks a variant that is being compiled.
+    paint_pipelines: Mutex<AHashMap<PaintFeatures, Option<Arc<wgpu::ComputePipeline>>>>,
 
     blit_pipeline: wgpu::RenderPipeline,
     blit_bg_layout: wgpu::BindGroupLayout,
 
     nearest_sampler: wgpu::Sampler,
     linear_sampler: wgpu::Sampler,
+
+    compile_time: Duration,
 }
 
 impl Pipelines {
-    pub fn new(device: &wgpu::Device) -> Self {
-        let render_bg_layout = device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
-            label: None,
-            entries: &[
-                wgpu::BindGroupLayoutEntry {
-                    binding: 0,
-                    visibility: wgpu::ShaderStages::COMPUTE,
-                    ty: wgpu::BindingType::Buffer {
-                        ty: wgpu::BufferBindingType::Uniform,
-                        has_dynamic_offset: false,
-                        min_binding_size: Some(
-                            NonZeroU64::new(size_of::<Globals>() as u64).unwrap(),
-                        ),
-                    },
-                    count: None,
+    pub fn new(device: &wgpu::Device, settings: &Settings) -> Self {
+        let start = Instant::now();
+        let intermediate_format = settings.intermediate_format;
+        let defines = ShaderDefines::new()
+            .flag_if(
+                "LINEAR_INTERMEDIATE",
+                intermediate_format == IntermediateFormat::LinearF16,
+            )
+            .flag_if(
+                "GRAYSCALE_GLYPHS",
+                settings.glyph_antialiasing == GlyphAntialiasing::Grayscale,
+            )
+            .constant("TILE_SIZE", settings.tile_size)
+            .constant("TILE_CAPACITY", settings.tile_capacity)
+            .constant(
+                "PAINT_WORKGROUP_SIZE",
+                settings.tile_size.min(MAX_PAINT_WORKGROUP_SIZE),
+            )
+            .constant("TILE_WORKGROUP_SIZE", TILE_WORKGROUP_SIZE)
+            .constant("SORT_WORKGROUP_SIZE", SORT_WORKGROUP_SIZE)
+            .constant("SDF_SPREAD", glyph::SDF_SPREAD);
+
+        let mut render_bg_entries = vec![
+            wgpu::BindGroupLayoutEntry {
+                binding: 0,
+                visibility: wgpu::ShaderStages::COMPUTE,
+                ty: wgpu::BindingType::Buffer {
+                    ty: wgpu::BufferBindingType::Uniform,
+                    has_dynamic_offset: false,
+                    min_binding_size: Some(NonZeroU64::new(size_of::<Globals>() as u64).unwrap()),
                 },
-                wgpu::BindGroupLayoutEntry {
-                    binding: 1,
-                    visibility: wgpu::ShaderStages::COMPUTE,
-                    ty: wgpu::BindingType::Buffer {
-                        ty: wgpu::BufferBindingType::Storage { read_only: true },
-                        has_dynamic_offset: false,
-                        min_binding_size: None,
-                    },
-                    count: None,
-                },
-                wgpu::BindGroupLayoutEntry {
-                    binding: 2,
-                    visibility: wgpu::ShaderStages::COMPUTE,
-                    ty: wgpu::BindingType::Buffer {
-                        ty: wgpu::BufferBindingType::Storage { read_only: true },
-                        has_dynamic_offset: false,
-                        min_binding_size: None,
-                    },
-                    count: None,
+                count: None,
+            },
+            wgpu::BindGroupLayoutEntry {
+                binding: 1,
+                visibility: wgpu::ShaderStages::COMPUTE,
+                ty: wgpu::BindingType::Buffer {
+                    ty: wgpu::BufferBindingType::Storage { read_only: true },
+                    has_dynamic_offset: false,
+                    min_binding_size: None,
                 },
-                wgpu::BindGroupLayoutEntry {
-                    binding: 3,
-                    visibility: wgpu::ShaderStages::COMPUTE,
-                    ty: wgpu::BindingType::Buffer {
-                        ty: wgpu::BufferBindingType::Storage { read_only: false },
-                        has_dynamic_offset: false,
-                        min_binding_size: None,
-                    },
-                    count: None,
+                count: None,
+            },
+            wgpu::BindGroupLayoutEntry {
+                binding: 2,
+                visibility: wgpu::ShaderStages::COMPUTE,
+                ty: wgpu::BindingType::Buffer {
+                    ty: wgpu::BufferBindingType::Storage { read_only: true },
+                    has_dynamic_offset: false,
+                    min_binding_size: None,
                 },
-                wgpu::BindGroupLayoutEntry {
-                    binding: 4,
-                    visibility: wgpu::ShaderStages::COMPUTE,
-                    ty: wgpu::BindingType::Buffer {
-                        ty: wgpu::BufferBindingType::Storage { read_only: false },
-                        has_dynamic_offset: false,
-                        min_binding_size: None,
-                    },
-                    count: None,
+                count: None,
+            },
+            wgpu::BindGroupLayoutEntry {
+                binding: 3,
+                visibility: wgpu::ShaderStages::COMPUTE,
+                ty: wgpu::BindingType::Buffer {
+                    ty: wgpu::BufferBindingType::Storage { read_only: false },
+                    has_dynamic_offset: false,
+                    min_binding_size: None,
                 },
-                wgpu::BindGroupLayoutEntry {
-                    binding: 5,
-                    visibility: wgpu::ShaderStages::COMPUTE,
-                    ty: wgpu::BindingType::StorageTexture {
-                        access: wgpu::StorageTextureAccess::ReadWrite,
-                        format: INTERMEDIATE_FORMAT,
-                        view_dimension: wgpu::TextureViewDimension::D2,
-                    },
-                    count: None,
+                count: None,
+            },
+            wgpu::BindGroupLayoutEntry {
+                binding: 4,
+                visibility: wgpu::ShaderStages::COMPUTE,
+                ty: wgpu::BindingType::Buffer {
+                    ty: wgpu::BufferBindingType::Storage { read_only: false },
+                    has_dynamic_offset: false,
+                    min_binding_size: None,
                 },
-                wgpu::BindGroupLayoutEntry {
-                    binding: 6,
-                    visibility: wgpu::ShaderStages::COMPUTE,
-                    ty: wgpu::BindingType::Sampler(wgpu::SamplerBindingType::Filtering),
-                    count: None,
+                count: None,
+            },
+            wgpu::BindGroupLayoutEntry {
+                binding: 5,
+                visibility: wgpu::ShaderStages::COMPUTE,
+                ty: wgpu::BindingType::StorageTexture {
+                    access: wgpu::StorageTextureAccess::ReadWrite,
+                    format: intermediate_format.texture_format(),
+                    view_dimension: wgpu::TextureViewDimension::D2,
                 },
-                wgpu::BindGroupLayoutEntry {
-                    binding: 7,
-                    visibility: wgpu::ShaderStages::COMPUTE,
-                    ty: wgpu::BindingType::Texture {
-                        sample_type: wgpu::TextureSampleType::Float { filterable: false },
-                        view_dimension: wgpu::TextureViewDimension::D2,
-                        multisampled: false,
-                    },
-                    count: None,
+                count: None,
+            },
+            wgpu::BindGroupLayoutEntry {
+                binding: 6,
+                visibility: wgpu::ShaderStages::COMPUTE,
+                ty: wgpu::BindingType::Sampler(wgpu::SamplerBindingType::Filtering),
+                count: None,
+            },
+            wgpu::BindGroupLayoutEntry {
+                binding: 8,
+                visibility: wgpu::ShaderStages::COMPUTE,
+                ty: wgpu::BindingType::Buffer {
+                    ty: wgpu::BufferBindingType::Storage { read_only: true },
+                    has_dynamic_offset: false,
+                    min_binding_size: None,
                 },
-                wgpu::BindGroupLayoutEntry {
-                    binding: 8,
-                    visibility: wgpu::ShaderStages::COMPUTE,
-                    ty: wgpu::BindingType::Buffer {
-                        ty: wgpu::BufferBindingType::Storage { read_only: true },
-                        has_dynamic_offset: false,
-                        min_binding_size: None,
-                    },
-                    count: None,
+                count: None,
+            },
+            wgpu::BindGroupLayoutEntry {
+                binding: 9,
+                visibility: wgpu::ShaderStages::COMPUTE,
+                ty: wgpu::BindingType::Texture {
+                    sample_type: wgpu::TextureSampleType::Float { filterable: true },
+                    view_dimension: wgpu::TextureViewDimension::D2,
+                    multisampled: false,
                 },
-                wgpu::BindGroupLayoutEntry {
-                    binding: 9,
-                    visibility: wgpu::ShaderStages::COMPUTE,
-                    ty: wgpu::BindingType::Texture {
-                        sample_type: wgpu::TextureSampleType::Float { filterable: true },
-                        view_dimension: wgpu::TextureViewDimension::D2,
-                        multisampled: false,
-                    },
-                    count: None,
+                count: None,
+            },
+            wgpu::BindGroupLayoutEntry {
+                binding: 10,
+                visibility: wgpu::ShaderStages::COMPUTE,
+                ty: wgpu::BindingType::Buffer {
+                    ty: wgpu::BufferBindingType::Storage { read_only: true },
+                    has_dynamic_offset: false,
+                    min_binding_size: None,
                 },
-                wgpu::BindGroupLayoutEntry {
-                    binding: 10,
-                    visibility: wgpu::ShaderStages::COMPUTE,
-                    ty: wgpu::BindingType::Buffer {
-                        ty: wgpu::BufferBindingType::Storage { read_only: true },
-                        has_dynamic_offset: false,
-                        min_binding_size: None,
-                    },
-                    count: None,
+                count: None,
+            },
+        ];
+        render_bg_entries.extend((0..MAX_GLYPH_ATLAS_PAGES).map(|page| {
+            wgpu::BindGroupLayoutEntry {
+                binding: glyph_atlas_binding(page),
+                visibility: wgpu::ShaderStages::COMPUTE,
+                ty: wgpu::BindingType::Texture {
+                    sample_type: wgpu::TextureSampleType::Float { filterable: false },
+                    view_dimension: wgpu::TextureViewDimension::D2,
+                    multisampled: false,
                 },
-            ],
+                count: None,
+            }
+        }));
+
+        let render_bg_layout = device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
+            label: None,
+            entries: &render_bg_entries,
         });
 
         let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
@@ -463,8 +807,12 @@ impl Pipelines {
             push_constant_ranges: &[],
         });
 
-        let render_module =
-            device.create_shader_module(wgpu::include_wgsl!("../shaders/render.wgsl"));
+        let render_module = shader::create_shader_module(
+            device,
+            "render",
+            RENDER_SHADER,
+            &PaintFeatures::ALL.apply(defines.clone()),
+        );
         let tile_pipeline = device.create_compute_pipeline(&wgpu::ComputePipelineDescriptor {
             label: None,
             layout: Some(&pipeline_layout),
@@ -477,6 +825,9 @@ impl Pipelines {
             module: &render_module,
             entry_point: "paint_kernel",
         });
+        let full_paint_pipeline = Arc::new(paint_pipeline);
+        let mut paint_pipelines = AHashMap::new();
+        paint_pipelines.insert(PaintFeatures::ALL, Some(Arc::clone(&full_paint_pipeline)));
         let sort_pipeline = device.create_compute_pipeline(&wgpu::ComputePipelineDescriptor {
             label: None,
             layout: Some(&pipeline_layout),
@@ -484,7 +835,12 @@ impl Pipelines {
             entry_point: "sort_kernel",
         });
 
-        let blit_module = device.create_shader_module(wgpu::include_wgsl!("../shaders/blit.wgsl"));
+        let blit_module = shader::create_shader_module(
+            device,
+            "blit",
+            include_str!("../shaders/blit.wgsl"),
+            &defines,
+        );
         let blit_bg_layout = device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
             label: None,
             entries: &[
@@ -492,7 +848,12 @@ impl Pipelines {
                     binding: 0,
                     visibility: wgpu::ShaderStages::FRAGMENT,
                     ty: wgpu::BindingType::Texture {
-                        sample_type: wgpu::TextureSampleType::Uint,
+                        sample_type: match intermediate_format {
+                            IntermediateFormat::Srgb8 => wgpu::TextureSampleType::Uint,
+                            IntermediateFormat::LinearF16 => {
+                                wgpu::TextureSampleType::Float { filterable: false }
+                            }
+                        },
                         view_dimension: wgpu::TextureViewDimension::D2,
                         multisampled: false,
                     },
@@ -516,6 +877,7 @@ impl Pipelines {
                 },
             ],
         });
+        let render_pipeline_layout = pipeline_layout;
         let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
             label: None,
             bind_group_layouts: &[&blit_bg_layout],
@@ -596,17 +958,66 @@ impl Pipelines {
             border_color: None,
         });
 
+        let compile_time = start.elapsed();
+        log::info!("Compiled pipelines in {:.1?}", compile_time);
+
         Self {
             tile_pipeline,
             sort_pipeline,
-            paint_pipeline,
             render_bg_layout,
+            render_pipeline_layout,
+            render_defines: defines,
+            full_paint_pipeline,
+            paint_pipelines: Mutex::new(paint_pipelines),
             blit_pipeline,
             blit_bg_layout,
             nearest_sampler,
             linear_sampler,
+
+            compile_time,
         }
     }
+
+    /// Gets the paint kernel specialized for `features`, or the kernel
+    /// with all features if the variant is not compiled yet.
+    ///
+    /// Returns `true` along with the kernel if the variant was not
+    /// requested before. It is then marked as being compiled, and the caller
+    /// must compile it with [`compile_paint_pipeline`](Self::compile_paint_pipeline).
+    fn paint_pipeline(&self, features: PaintFeatures) -> (Arc<wgpu::ComputePipeline>, bool) {
+        let mut pipelines = self.paint_pipelines.lock();
+        match pipelines.get(&features) {
+            Some(Some(pipeline)) => (Arc::clone(pipeline), false),
+            Some(None) => (Arc::clone(&self.full_paint_pipeline), false),
+            None => {
+                pipelines.insert(features, None);
+                (Arc::clone(&self.full_paint_pipeline), true)
+            }
+        }
+    }
+
+    /// Compiles the paint kernel variant for `features`.
+    ///
+    /// The `paint_pipelines` lock is only taken to store the result,
+    /// so rendering is not blocked while the shader compiles.
+    fn compile_paint_pipeline(&self, device: &wgpu::Device, features: PaintFeatures) {
+        log::debug!("Compiling paint kernel for {:?}", features);
+        let module = shader::create_shader_module(
+            device,
+            "render",
+            RENDER_SHADER,
+            &features.apply(self.render_defines.clone()),
+        );
+        let pipeline = device.create_compute_pipeline(&wgpu::ComputePipelineDescriptor {
+            label: None,
+            layout: Some(&self.render_pipeline_layout),
+            module: &module,
+            entry_point: "paint_kernel",
+        });
+        self.paint_pipelines
+            .lock()
+            .insert(features, Some(Arc::new(pipeline)));
+    }
 }
 
 #[derive(Pod, Zeroable, Debug, Copy, Clone)]
@@ -634,10 +1045,21 @@ pub enum PaintType {
         color_outer: Srgba<u8>,
     },
     Glyph {
+        page: u32,
         offset_in_atlas: UVec2,
         origin: UVec2,
         color: Srgba<u8>,
     },
+    /// A distance field glyph. `origin` is in physical pixels,
+    /// like the origin of bitmap glyphs, but need not be whole.
+    SdfGlyph {
+        page: u32,
+        offset_in_atlas: UVec2,
+        size_in_atlas: UVec2,
+        origin: Vec2,
+        texels_per_pixel: f32,
+        color: Srgba<u8>,
+    },
     Texture {
         offset_in_atlas: UVec2,
         origin: Vec2,
@@ -662,7 +1084,7 @@ impl PaintType {
                 *center = transform.transform_point2(*center);
                 *radius = transform_scalar(*radius, transform);
             }
-            PaintType::Glyph { .. } => {}
+            PaintType::Glyph { .. } | PaintType::SdfGlyph { .. } => {}
             PaintType::Texture { origin, scale, .. } => {
                 *origin = transform.transform_point2(*origin);
                 *scale /= transform_scalar(1., transform);
@@ -838,8 +1260,63 @@ struct PackedBoundingBox {
     size: u32,
 }
 
+/// The scratch texture used by [`Renderer::scroll_layer`].
+struct ScrollScratch {
+    texture: wgpu::Texture,
+    size: UVec2,
+}
+
+impl ScrollScratch {
+    /// Gets the scratch texture, reallocating it if it is smaller than `size`.
+    fn get<'a>(scratch: &'a mut Option<Self>, context: &Context, size: UVec2) -> &'a Self {
+        let size = match scratch {
+            Some(existing) if existing.size.cmpge(size).all() => return scratch.as_ref().unwrap(),
+            Some(existing) => existing.size.max(size),
+            None => size,
+        };
+        let texture = context.device().create_texture(&wgpu::TextureDescriptor {
+            label: Some("scroll_scratch"),
+            size: wgpu::Extent3d {
+                width: size.x,
+                height: size.y,
+                depth_or_array_layers: 1,
+            },
+            mip_level_count: 1,
+            sample_count: 1,
+            dimension: wgpu::TextureDimension::D2,
+            format: context.settings().intermediate_format.texture_format(),
+            usage: wgpu::TextureUsages::COPY_SRC | wgpu::TextureUsages::COPY_DST,
+        });
+        scratch.insert(Self { texture, size })
+    }
+}
+
+/// A copy of already-rendered pixels within a layer,
+/// used to implement scroll hints.
+///
+/// All lengths are in physical pixels.
+#[derive(Copy, Clone, Debug)]
+pub struct ScrollCopy {
+    src: UVec2,
+    dst: UVec2,
+    size: UVec2,
+}
+
+/// A range of tiles (exclusive of `max`) that must be repainted.
+#[derive(Copy, Clone, Debug)]
+struct TileRange {
+    min: UVec2,
+    max: UVec2,
+}
+
 /// A batch is a list of draw commands prepared
 /// for rendering in one compute pass.
+///
+/// Draw data is recorded into `Vec`s and copied into mapped staging memory
+/// once, by [`Renderer::prepare_render`]. It is not recorded into mapped memory
+/// directly: a mapped view borrows its buffer, so it cannot be kept on the
+/// batch between draw calls, and mapping chunks during drawing would need
+/// the device and the frame's encoder, which a batch does not have.
 pub struct Batch {
     nodes: Vec<PackedNode>,
     node_bounding_boxes: Vec<PackedBoundingBox>,
@@ -850,7 +1327,17 @@ pub struct Batch {
     logical_size: Vec2,
     scale_factor: f32,
 
+    tile_size: u32,
+    tile_capacity: u32,
+
+    features: PaintFeatures,
+
     texture_set: Option<TextureSetId>,
+
+    scrolls: Vec<ScrollCopy>,
+    /// If `Some`, then only these tiles are painted; all
+    /// other tiles keep the layer's existing contents.
+    damage: Option<Vec<TileRange>>,
 }
 
 impl Batch {
@@ -863,7 +1350,15 @@ impl Batch {
             .bounding_box()
             .map(|r| r.bbox_transformed(node.transform))
         {
-            if !self.will_draw(bbox) {
+            // Fill segments contribute coverage to all tiles to their right,
+            // so they have to be kept if any part of the path is repainted.
+            let damage_bbox = match node.shape {
+                Shape::Fill {
+                    fill_bounding_box, ..
+                } => fill_bounding_box,
+                _ => bbox,
+            };
+            if !self.will_draw(bbox) || !self.intersects_damage(damage_bbox) {
                 return;
             }
 
@@ -880,6 +1375,125 @@ impl Batch {
         !(max.x < 0. || max.y < 0. || min.x > self.logical_size.x || min.y > self.logical_size.y)
     }
 
+    /// Culls nodes that do not touch any repainted tile.
+    fn intersects_damage(&self, bbox: Rect) -> bool {
+        match &self.damage {
+            Some(damage) => damage.iter().any(|range| {
+                let min = (range.min * self.tile_size).as_vec2() / self.scale_factor;
+                let max = (range.max * self.tile_size).as_vec2() / self.scale_factor;
+                bbox.overlaps(Rect::new(min, max - min))
+            }),
+            None => true,
+        }
+    }
+
+    /// Records that the layer's pixels within `region` moved by `delta`.
+    ///
+    /// Both are in logical pixels; `delta` is rounded to whole physical pixels.
+    pub fn scroll(&mut self, region: Rect, delta: Vec2) {
+        let physical_size = self.physical_size.as_vec2();
+        let min = (region.pos * self.scale_factor)
+            .round()
+            .clamp(Vec2::ZERO, physical_size);
+        let max = (region.bottom_right() * self.scale_factor)
+            .round()
+            .clamp(Vec2::ZERO, physical_size);
+        let delta = (delta * self.scale_factor).round();
+
+        self.damage.get_or_insert_with(Vec::new);
+
+        // Region of pixels that are still visible after the shift
+        let dst_min = (min + delta).max(min);
+        let dst_max = (max + delta).min(max);
+        if dst_min.x >= dst_max.x || dst_min.y >= dst_max.y {
+            self.add_damage(min, max);
+            return;
+        }
+
+        if delta != Vec2::ZERO {
+            self.scrolls.push(ScrollCopy {
+                src: (dst_min - delta).as_uvec2(),
+                dst: dst_min.as_uvec2(),
+                size: (dst_max - dst_min).as_uvec2(),
+            });
+        }
+
+        // Repaint the newly exposed strips.
+        if dst_min.x > min.x {
+            self.add_damage(min, vec2(dst_min.x, max.y));
+        }
+        if dst_max.x < max.x {
+            self.add_damage(vec2(dst_max.x, min.y), max);
+        }
+        if dst_min.y > min.y {
+            self.add_damage(min, vec2(max.x, dst_min.y));
+        }
+        if dst_max.y < max.y {
+            self.add_damage(vec2(min.x, dst_max.y), max);
+        }
+    }
+
+    /// Marks a region (in logical pixels) as needing to be repainted.
+    pub fn invalidate(&mut self, region: Rect) {
+        self.damage.get_or_insert_with(Vec::new);
+        self.add_damage(
+            region.pos * self.scale_factor,
+            region.bottom_right() * self.scale_factor,
+        );
+    }
+
+    /// Adds the tiles covering the given physical region to the damage list.
+    fn add_damage(&mut self, min: Vec2, max: Vec2) {
+        let tile_count = self.tile_count();
+        let min = (min.max(Vec2::ZERO) / self.tile_size as f32)
+            .floor()
+            .as_uvec2()
+            .min(tile_count);
+        let max = (max.max(Vec2::ZERO) / self.tile_size as f32)
+            .ceil()
+            .as_uvec2()
+            .min(tile_count);
+        if min.x < max.x && min.y < max.y {
+            self.damage
+                .get_or_insert_with(Vec::new)
+                .push(TileRange { min, max });
+        }
+    }
+
+    /// Removes all draw commands and hints, keeping allocated capacity.
+    pub fn clear(&mut self) {
+        self.nodes.clear();
+        self.node_bounding_boxes.clear();
+        self.points.clear();
+        self.scissors.clear();
+        self.texture_set = None;
+        self.features = PaintFeatures::default();
+        self.scrolls.clear();
+        self.damage = None;
+    }
+
+    pub fn has_damage(&self) -> bool {
+        self.damage.is_some()
+    }
+
+    pub fn take_scrolls(&mut self) -> Vec<ScrollCopy> {
+        mem::take(&mut self.scrolls)
+    }
+
+    /// Writes the initial tile counter values, marking tiles
+    /// that should not be painted with `TILE_CLEAN`.
+    fn write_tile_mask(&self, mask: &mut [u32]) {
+        mask.fill(TILE_CLEAN);
+        let tile_count = self.tile_count();
+        for range in self.damage.iter().flatten() {
+            for y in range.min.y..range.max.y {
+                for x in range.min.x..range.max.x {
+                    mask[(x + y * tile_count.x) as usize] = 0;
+                }
+            }
+        }
+    }
+
     pub fn logical_size(&self) -> Vec2 {
         self.logical_size
     }
@@ -893,12 +1507,12 @@ impl Batch {
     }
 
     fn tile_count(&self) -> UVec2 {
-        (self.physical_size + UVec2::splat(TILE_SIZE - 1)) / UVec2::splat(TILE_SIZE)
+        (self.physical_size + UVec2::splat(self.tile_size - 1)) / UVec2::splat(self.tile_size)
     }
 
     fn tile_buffer_size(&self) -> u64 {
         let num_tiles = self.tile_count().x * self.tile_count().y;
-        (num_tiles as u64) * 64 * (size_of::<u32>() as u64)
+        (num_tiles as u64) * (self.tile_capacity as u64) * (size_of::<u32>() as u64)
     }
 
     fn tile_counters_buffer_size(&self) -> u64 {
@@ -952,6 +1566,7 @@ impl Batch {
                 border_radius,
                 stroke_width,
             } => {
+                self.features.insert(PaintFeatures::RECT);
                 packed.shape = if stroke_width.is_some() {
                     SHAPE_STROKE_RECT
                 } else {
@@ -966,6 +1581,7 @@ impl Batch {
                 radius,
                 stroke_width,
             } => {
+                self.features.insert(PaintFeatures::CIRCLE);
                 packed.shape = if stroke_width.is_some() {
                     SHAPE_STROKE_CIRCLE
                 } else {
@@ -980,6 +1596,7 @@ impl Batch {
                 cap,
                 path_id,
             } => {
+                self.features.insert(PaintFeatures::STROKE_PATH);
                 packed.shape = SHAPE_STROKE_PATH;
 
                 let base_index = self.points.len() as u32;
@@ -995,6 +1612,7 @@ impl Batch {
                 path_id,
                 fill_bounding_box,
             } => {
+                self.features.insert(PaintFeatures::FILL_PATH);
                 packed.shape = SHAPE_FILL_PATH;
 
                 let base_index = self.points.len() as u32;
@@ -1014,6 +1632,7 @@ impl Batch {
 
         match node.paint_type {
             PaintType::Solid(color) => {
+                self.features.insert(PaintFeatures::SOLID);
                 packed.paint_type = PAINT_TYPE_SOLID;
                 packed.color_a = self.pack_color(color);
             }
@@ -1023,6 +1642,7 @@ impl Batch {
                 color_a,
                 color_b,
             } => {
+                self.features.insert(PaintFeatures::LINEAR_GRADIENT);
                 packed.paint_type = PAINT_TYPE_LINEAR_GRADIENT;
                 packed.color_a = self.pack_color(color_a);
                 packed.color_b = self.pack_color(color_b);
@@ -1035,6 +1655,7 @@ impl Batch {
                 color_center,
                 color_outer,
             } => {
+                self.features.insert(PaintFeatures::RADIAL_GRADIENT);
                 packed.paint_type = PAINT_TYPE_RADIAL_GRADIENT;
                 packed.color_a = self.pack_color(color_center);
                 packed.color_b = self.pack_color(color_outer);
@@ -1042,15 +1663,39 @@ impl Batch {
                 packed.gradient_point_b = self.pack_pos(vec2(radius, 0.));
             }
             PaintType::Glyph {
+                page,
                 offset_in_atlas,
                 origin,
                 color,
             } => {
+                self.features.insert(PaintFeatures::GLYPH);
                 packed.paint_type = PAINT_TYPE_GLYPH;
                 packed.color_a = self.pack_color(color);
+                packed.color_b = page;
                 packed.gradient_point_a = self.pack_upos(offset_in_atlas);
                 packed.gradient_point_b = self.pack_upos(origin);
             }
+            PaintType::SdfGlyph {
+                page,
+                offset_in_atlas,
+                size_in_atlas,
+                origin,
+                texels_per_pixel,
+                color,
+            } => {
+                let index = self.points.len() as u32;
+                self.points.push(page);
+                self.points.push(texels_per_pixel.to_bits());
+                self.points.push(origin.x.to_bits());
+                self.points.push(origin.y.to_bits());
+
+                self.features.insert(PaintFeatures::SDF_GLYPH);
+                packed.paint_type = PAINT_TYPE_SDF_GLYPH;
+                packed.color_a = self.pack_color(color);
+                packed.color_b = index;
+                packed.gradient_point_a = self.pack_upos(offset_in_atlas);
+                packed.gradient_point_b = self.pack_upos(size_in_atlas);
+            }
             PaintType::Texture {
                 offset_in_atlas,
                 origin,
@@ -1063,6 +1708,7 @@ impl Batch {
                 self.points.push(texture_size.x);
                 self.points.push(texture_size.y);
 
+                self.features.insert(PaintFeatures::TEXTURE);
                 packed.paint_type = PAINT_TYPE_TEXTURE;
                 packed.gradient_point_a = self.pack_upos(offset_in_atlas);
                 packed.gradient_point_b = self.pack_pos(origin);
@@ -1080,6 +1726,7 @@ impl Batch {
         }
 
         if let Some(scissor) = node.scissor {
+            self.features.insert(PaintFeatures::SCISSOR);
             self.scissors.push(scissor.into());
             let id = self.scissors.len(); // + 1 - 1
             packed.scissor = id.try_into().expect("too many scissors whoops");
@@ -1096,8 +1743,115 @@ impl Batch {
     }
 }
 
+/// A device-local buffer that is reused between frames
+/// and reallocated when its contents outgrow it.
+struct GrowableBuffer {
+    buffer: wgpu::Buffer,
+    capacity: u64,
+    usage: wgpu::BufferUsages,
+    label: &'static str,
+}
+
+impl GrowableBuffer {
+    fn new(device: &wgpu::Device, label: &'static str, usage: wgpu::BufferUsages) -> Self {
+        let usage = usage | wgpu::BufferUsages::COPY_DST;
+        let capacity = 1024;
+        Self {
+            buffer: Self::create(device, label, usage, capacity),
+            capacity,
+            usage,
+            label,
+        }
+    }
+
+    fn create(
+        device: &wgpu::Device,
+        label: &'static str,
+        usage: wgpu::BufferUsages,
+        size: u64,
+    ) -> wgpu::Buffer {
+        device.create_buffer(&wgpu::BufferDescriptor {
+            label: Some(label),
+            size,
+            usage,
+            mapped_at_creation: false,
+        })
+    }
+
+    /// Reallocates the buffer if it is smaller than `size`.
+    /// Its contents are lost when that happens.
+    fn reserve(&mut self, device: &wgpu::Device, size: u64) {
+        if size > self.capacity {
+            self.capacity = size.next_power_of_two();
+            self.buffer = Self::create(device, self.label, self.usage, self.capacity);
+        }
+    }
+
+    /// Encodes a copy of `data` to the start of the buffer.
+    ///
+    /// `data` is copied once into mapped staging memory; see [`Batch`]
+    /// for why it is not recorded there in the first place.
+    fn write(
+        &mut self,
+        device: &wgpu::Device,
+        encoder: &mut wgpu::CommandEncoder,
+        belt: &mut StagingBelt,
+        data: &[u8],
+    ) {
+        self.write_with(device, encoder, belt, data.len() as u64, |bytes| {
+            bytes.copy_from_slice(data)
+        });
+    }
+
+    /// Encodes a write of `size` bytes to the start of the buffer,
+    /// calling `fill` to produce them directly in mapped staging memory.
+    fn write_with(
+        &mut self,
+        device: &wgpu::Device,
+        encoder: &mut wgpu::CommandEncoder,
+        belt: &mut StagingBelt,
+        size: u64,
+        fill: impl FnOnce(&mut [u8]),
+    ) {
+        let size = match NonZeroU64::new(size) {
+            Some(s) => s,
+            None => return,
+        };
+
+        self.reserve(device, size.get());
+        fill(&mut belt.write_buffer(encoder, &self.buffer, 0, size, device));
+    }
+}
+
+/// GPU buffers owned by a canvas and reused for each batch it renders.
+///
+/// Batch data is written into a ring of mapped staging buffers
+/// and copied into device-local buffers within the frame's command encoder,
+/// so no buffers are created for this data on each frame.
+pub struct RenderBuffers {
+    belt: StagingBelt,
+    globals: GrowableBuffer,
+    nodes: GrowableBuffer,
+    node_bounding_boxes: GrowableBuffer,
+    points: GrowableBuffer,
+    scissors: GrowableBuffer,
+    tile_nodes: GrowableBuffer,
+    tile_counters: GrowableBuffer,
+}
+
+impl RenderBuffers {
+    /// Makes staging memory used by submitted frames available again.
+    ///
+    /// Must be called after submitting the command encoder passed
+    /// to [`Renderer::prepare_render`].
+    pub fn recall(&mut self) {
+        self.belt.recall();
+    }
+}
+
 /// A render that is ready to be fed to a `CommandEncoder`.
 pub struct PreparedRender {
+    paint_pipeline: Arc<wgpu::ComputePipeline>,
     bind_group: wgpu::BindGroup,
     tile_count: UVec2,
     node_count: u32,
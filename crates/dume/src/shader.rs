@@ -0,0 +1,148 @@
+//! A minimal preprocessor for our WGSL sources.
+//!
+//! `naga` has no support for pipeline-overridable constants or
+//! conditional compilation, so we specialize shaders textually
+//! before creating the shader module. Supported directives, each on its own line:
+//! * `#ifdef NAME`, `#ifndef NAME`, `#else`, `#endif`
+//!
+//! Additionally, every occurrence of `{{NAME}}` is replaced by the value
+//! of the constant `NAME`.
+
+use std::borrow::Cow;
+
+use ahash::AHashSet;
+
+/// The set of flags and constants used to specialize a shader.
+#[derive(Debug, Clone, Default)]
+pub struct ShaderDefines {
+    flags: AHashSet<&'static str>,
+    constants: Vec<(&'static str, String)>,
+}
+
+impl ShaderDefines {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Enables `#ifdef name` blocks.
+    pub fn flag(mut self, name: &'static str) -> Self {
+        self.flags.insert(name);
+        self
+    }
+
+    /// Enables `#ifdef name` blocks if `enabled` is true.
+    pub fn flag_if(self, name: &'static str, enabled: bool) -> Self {
+        if enabled {
+            self.flag(name)
+        } else {
+            self
+        }
+    }
+
+    /// Replaces `{{name}}` with `value`.
+    pub fn constant(mut self, name: &'static str, value: impl ToString) -> Self {
+        self.constants.push((name, value.to_string()));
+        self
+    }
+
+    fn is_set(&self, name: &str) -> bool {
+        self.flags.contains(name)
+    }
+}
+
+/// Specializes WGSL source code using the given defines.
+///
+/// # Panics
+/// Panics on unbalanced or unknown directives. Since shader sources
+/// are embedded in the binary, this indicates a bug.
+pub fn preprocess(source: &str, defines: &ShaderDefines) -> String {
+    let mut output = String::with_capacity(source.len());
+    // One entry per nested #ifdef: (is this block active, was the parent active)
+    let mut stack: Vec<(bool, bool)> = Vec::new();
+
+    for line in source.lines() {
+        let active = stack.last().map(|&(active, _)| active).unwrap_or(true);
+        let trimmed = line.trim();
+        if let Some(directive) = trimmed.strip_prefix('#') {
+            let mut parts = directive.split_whitespace();
+            match (parts.next(), parts.next()) {
+                (Some("ifdef"), Some(name)) => {
+                    stack.push((active && defines.is_set(name), active));
+                }
+                (Some("ifndef"), Some(name)) => {
+                    stack.push((active && !defines.is_set(name), active));
+                }
+                (Some("else"), None) => {
+                    let (block_active, parent_active) = stack.pop().expect("#else without #ifdef");
+                    stack.push((parent_active && !block_active, parent_active));
+                }
+                (Some("endif"), None) => {
+                    stack.pop().expect("#endif without #ifdef");
+                }
+                _ => panic!("unknown shader directive: {}", line),
+            }
+            // Keep line numbers stable for naga's error messages.
+            output.push('\n');
+            continue;
+        }
+
+        if active {
+            output.push_str(&substitute(line, defines));
+        }
+        output.push('\n');
+    }
+
+    assert!(stack.is_empty(), "unterminated #ifdef in shader");
+    output
+}
+
+fn substitute<'a>(line: &'a str, defines: &ShaderDefines) -> Cow<'a, str> {
+    if !line.contains("{{") {
+        return Cow::Borrowed(line);
+    }
+
+    let mut line = line.to_owned();
+    for (name, value) in &defines.constants {
+        line = line.replace(&format!("{{{{{}}}}}", name), value);
+    }
+    assert!(
+        !line.contains("{{"),
+        "undefined shader constant in line: {}",
+        line
+    );
+    Cow::Owned(line)
+}
+
+/// Creates a shader module from preprocessed WGSL source.
+pub fn create_shader_module(
+    device: &wgpu::Device,
+    label: &'static str,
+    source: &str,
+    defines: &ShaderDefines,
+) -> wgpu::ShaderModule {
+    device.create_shader_module(wgpu::ShaderModuleDescriptor {
+        label: Some(label),
+        source: wgpu::ShaderSource::Wgsl(Cow::Owned(preprocess(source, defines))),
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_preprocess() {
+        let source = "a\n#ifdef X\nb\n#ifndef Y\nc\n#else\nd\n#endif\n#else\ne\n#endif\nf {{N}}";
+        let defines = ShaderDefines::new().flag("X").constant("N", 16);
+        assert_eq!(
+            preprocess(source, &defines),
+            "a\n\nb\n\nc\n\n\n\n\n\n\nf 16\n"
+        );
+
+        let defines = ShaderDefines::new().constant("N", 8);
+        assert_eq!(
+            preprocess(source, &defines),
+            "a\n\n\n\n\n\n\n\n\ne\n\nf 8\n"
+        );
+    }
+}
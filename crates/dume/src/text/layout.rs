@@ -3,26 +3,39 @@
 //! For an overview of the text layout hierarchy,
 //! see https://raphlinus.github.io/text/2020/10/26/text-layout.html.
 
-use std::{cell::RefCell, ops::Range};
+use std::{cell::RefCell, mem, ops::Range, sync::Arc};
 
 use glam::{vec2, Vec2};
+use once_cell::sync::OnceCell;
 use palette::Srgba;
+use parking_lot::{Mutex, MutexGuard};
 use serde::{Deserialize, Serialize};
+use smallvec::SmallVec;
 use smartstring::{LazyCompact, SmartString};
 use swash::{
     shape::{Direction, ShapeContext},
-    text::{Properties, Script},
-    GlyphId,
+    text::{cluster::Boundary, Codepoint, GeneralCategory, Properties, Script},
+    FontRef, GlyphId,
 };
 use unicode_bidi::{BidiInfo, Level};
 
-use crate::{Context, FontId, Text, TextSection, TextStyle, TextureId};
+use crate::{
+    canvas::TextDrawCache, font::Fonts, Context, FontId, Text, TextSection, TextStyle, TextureId,
+};
 
 thread_local! {
     static SHAPE_CONTEXT: RefCell<ShapeContext> = RefCell::new(ShapeContext::new());
 }
 
+mod blob_cache;
+mod line_break;
 mod resize;
+mod shape_cache;
+
+pub use blob_cache::{BlobCache, BlobKey};
+use line_break::LineBreaks;
+pub use shape_cache::{ShapeCache, ShapeCacheStats};
+use shape_cache::{ShapeKey, ShapedRunGlyph};
 
 #[derive(Copy, Clone, Debug, PartialEq, Eq, Hash, Serialize, Deserialize)]
 #[repr(C)]
@@ -61,7 +74,7 @@ impl Default for Baseline {
 ///
 /// TODO: should some parameters be moved to the rich text
 /// representation, so that alignments can be mixed within a blob?
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 pub struct TextOptions {
     /// Whether to overflow onto a new line when the maximum width is reached.
     ///
@@ -88,17 +101,21 @@ impl Default for TextOptions {
     }
 }
 
+/// Number of widths remembered by `TextBlob::measure`.
+const MEASUREMENT_MEMO_LEN: usize = 8;
+
 struct CharInfo {
     properties: Properties,
+    boundary: Boundary,
 }
 
 /// A blob of text that has been laid out and shaped into glyphs.
 ///
 /// Created with [`Context::create_text_blob`](crate::Context::create_text_blob).
 ///
-/// You need to call [`Context::resize_text_blob`] to set the maximum text dimensions
-/// and compute glyph layout.
-/// If you don't call this method at least once, the text will render as empty.
+/// Call [`Context::resize_text_blob`] to set the maximum text dimensions
+/// and compute glyph layout. Until then, the text is laid out
+/// on a single line per paragraph, at its [`TextBlob::max_content_size`].
 pub struct TextBlob {
     options: TextOptions,
 
@@ -112,11 +129,23 @@ pub struct TextBlob {
 
     max_size: Vec2,
     glyphs: Vec<ShapedGlyph>,
+    breaks: LineBreaks,
+    /// Whether `glyphs` have been positioned by `resize`.
+    laid_out: bool,
+    /// Glyphs positioned at the max content size, computed when
+    /// the blob is drawn before its first resize.
+    unsized_glyphs: OnceCell<Vec<ShapedGlyph>>,
 
     size: Vec2,
 
     min_content_size: Vec2,
     max_content_size: Vec2,
+
+    /// Recent results of `measure`, most recent first.
+    measurements: Mutex<SmallVec<[(u32, Vec2); MEASUREMENT_MEMO_LEN]>>,
+
+    /// Glyph placements from the last draw, reused by `Canvas::draw_text`.
+    draw_cache: Mutex<Option<TextDrawCache>>,
 }
 
 impl TextBlob {
@@ -125,11 +154,14 @@ impl TextBlob {
         let BidiInfo { levels, .. } = BidiInfo::new(&unstyled_text, None);
 
         let mut char_info = Vec::with_capacity(unstyled_text.len());
-        for ((properties, _boundary), c) in
+        for ((properties, boundary), c) in
             swash::text::analyze(unstyled_text.chars()).zip(unstyled_text.chars())
         {
             for _ in 0..c.len_utf8() {
-                char_info.push(CharInfo { properties });
+                char_info.push(CharInfo {
+                    properties,
+                    boundary,
+                });
             }
         }
 
@@ -142,26 +174,55 @@ impl TextBlob {
 
             max_size: Vec2::ZERO,
             glyphs: Vec::new(),
+            breaks: LineBreaks::default(),
+            laid_out: false,
+            unsized_glyphs: OnceCell::new(),
 
             size: Vec2::ZERO,
 
             min_content_size: Vec2::ZERO,
-            max_content_size: Vec2::splat(f32::INFINITY),
+            max_content_size: Vec2::ZERO,
+
+            measurements: Mutex::new(SmallVec::new()),
+
+            draw_cache: Mutex::new(None),
         };
         blob.compute_runs(cx, text);
-        blob.shape_glyphs(cx, text);
-        blob.resize(cx, Vec2::splat(f32::INFINITY));
+        let break_before = blob.shape_glyphs(cx, text);
+        blob.breaks = LineBreaks::new(&blob.glyphs, &break_before, &cx.fonts());
+
+        let max_width = blob.breaks.max_width();
+        let min_width = if blob.options.wrap_lines {
+            blob.breaks.min_width()
+        } else {
+            max_width
+        };
+        blob.min_content_size = vec2(min_width, blob.height_for_width(min_width));
+        blob.max_content_size = vec2(max_width, blob.height_for_width(max_width));
+
+        // Layout waits until the blob is resized or drawn, so a blob
+        // that is resized right away is only laid out once.
 
         blob
     }
 
     fn compute_runs(&mut self, cx: &Context, text: &Text) {
-        // Merge BiDi, style, and script runs.
+        // Merge BiDi, style, script, and font fallback runs.
+        let fonts = cx.fonts();
         let mut byte_index = 0;
         for section in &text.sections {
             match section {
                 TextSection::Text { text, style } => {
-                    self.build_runs(text, style, byte_index);
+                    let font = fonts
+                        .query(&style.font)
+                        .expect("could not resolve font query");
+                    let fallbacks = fonts.fallbacks(&style.font);
+                    let run_fonts = RunFonts {
+                        fonts: &fonts,
+                        primary: font,
+                        fallbacks: &fallbacks,
+                    };
+                    self.build_runs(text, style, &run_fonts, byte_index);
                     byte_index += text.len();
                 }
                 TextSection::Icon { name, size } => {
@@ -178,13 +239,13 @@ impl TextBlob {
         }
     }
 
-    fn build_runs(&mut self, text: &str, style: &TextStyle, byte_index: usize) {
+    fn build_runs(&mut self, text: &str, style: &TextStyle, fonts: &RunFonts, byte_index: usize) {
         // Check for explicit line breaks.
         for (i, c) in text.char_indices() {
             if c == '\n' {
-                self.build_runs(&text[..i], style, byte_index);
+                self.build_runs(&text[..i], style, fonts, byte_index);
                 self.runs.push(BlobRun::ExplicitLineBreak);
-                self.build_runs(&text[i + 1..], style, byte_index + i + 1);
+                self.build_runs(&text[i + 1..], style, fonts, byte_index + i + 1);
                 return;
             }
         }
@@ -202,69 +263,76 @@ impl TextBlob {
             for (script, script_run) in script_runs {
                 let script_start = start + script_run.start;
                 let script_end = start + script_run.end;
-                self.runs.push(BlobRun::Text {
-                    text: (&text[(script_start - byte_index)..(script_end - byte_index)]).into(),
-                    style: style.clone(),
-                    script,
-                    bidi_level: self.bidi_levels[start],
-                });
+                let script_text = &text[(script_start - byte_index)..(script_end - byte_index)];
+                for (font, font_run) in fonts.split(script_text) {
+                    self.runs.push(BlobRun::Text {
+                        start: script_start + font_run.start,
+                        text: (&script_text[font_run]).into(),
+                        style: style.clone(),
+                        font,
+                        script,
+                        bidi_level: self.bidi_levels[start],
+                    });
+                }
             }
         }
     }
 
-    fn shape_glyphs(&mut self, cx: &Context, root_text: &Text) {
-        // Shape each run.
+    /// Shapes each run, returning whether a line may wrap before each glyph.
+    fn shape_glyphs(&mut self, cx: &Context, root_text: &Text) -> Vec<bool> {
         let fonts = cx.fonts();
         SHAPE_CONTEXT.with(move |cell| {
             let mut shape_ctx = cell.borrow_mut();
+            let mut break_before = Vec::new();
             for run in &self.runs {
                 match run {
                     BlobRun::Text {
+                        start,
                         text,
                         style,
+                        font: font_id,
                         bidi_level,
                         script,
                     } => {
-                        let font_id = fonts
-                            .query(&style.font)
-                            .expect("could not resolve font query");
-                        let font = fonts.get(font_id);
-
-                        let dir = if bidi_level.is_ltr() {
-                            Direction::LeftToRight
-                        } else {
-                            Direction::RightToLeft
+                        let size = style.size.unwrap_or(root_text.default_size);
+
+                        let key = ShapeKey::new(text, font_id, size, *script, !bidi_level.is_ltr());
+                        let cached = cx.shape_cache().get(&key);
+                        let shaped = match cached {
+                            Some(shaped) => shaped,
+                            None => {
+                                let shaped = shape_run(
+                                    &mut shape_ctx,
+                                    fonts.get(font_id),
+                                    text,
+                                    size,
+                                    *script,
+                                    bidi_level,
+                                );
+                                cx.shape_cache().insert(key, Arc::clone(&shaped));
+                                shaped
+                            }
                         };
 
-                        let mut shaper = shape_ctx
-                            .builder(font)
-                            .script(*script)
-                            .direction(dir)
-                            .size(style.size.unwrap_or(root_text.default_size))
-                            .build();
-
-                        shaper.add_str(text);
-
-                        shaper.shape_with(|cluster| {
-                            for glyph in cluster.glyphs {
-                                self.glyphs.push(ShapedGlyph {
-                                    pos: Vec2::ZERO, // computed later
-                                    offset: vec2(glyph.x, glyph.y),
-                                    advance: glyph.advance,
-                                    c: GlyphCharacter::Glyph(
-                                        glyph.id,
-                                        style.size.unwrap_or(root_text.default_size),
-                                        (&text[cluster.source.start as usize..])
-                                            .chars()
-                                            .next()
-                                            .unwrap(),
-                                    ),
-                                    font: font_id,
-                                    color: style.color.unwrap_or(root_text.default_color),
-                                    size: style.size.unwrap_or(root_text.default_size),
-                                });
-                            }
-                        });
+                        for (i, glyph) in shaped.iter().enumerate() {
+                            // Line break opportunities are between clusters.
+                            let cluster_start = i == 0 || shaped[i - 1].cluster != glyph.cluster;
+                            let boundary = self.char_info[start + glyph.cluster as usize].boundary;
+                            break_before.push(
+                                cluster_start
+                                    && matches!(boundary, Boundary::Line | Boundary::Mandatory),
+                            );
+
+                            self.glyphs.push(ShapedGlyph {
+                                pos: Vec2::ZERO, // computed later
+                                offset: glyph.offset,
+                                advance: glyph.advance,
+                                c: GlyphCharacter::Glyph(glyph.id, size, glyph.c),
+                                font: font_id,
+                                color: style.color.unwrap_or(root_text.default_color),
+                                size,
+                            });
+                        }
                     }
                     BlobRun::Icon { texture, size } => self.glyphs.push(ShapedGlyph {
                         pos: Vec2::ZERO,
@@ -285,42 +353,185 @@ impl TextBlob {
                         color: Default::default(),
                     }),
                 }
+                // Icons and explicit line breaks are not break opportunities.
+                break_before.resize(self.glyphs.len(), false);
             }
-        });
+            break_before
+        })
     }
 
     /// Lays out the text, performing glyph positioning and line wrapping.
     pub fn resize(&mut self, cx: &Context, max_size: Vec2) {
         // No need to recompute if the max size hasn't changed by much.
-        if !self.should_resize_for(max_size) {
+        if self.laid_out && !self.should_resize_for(max_size) {
             return;
         }
 
         self.max_size = max_size;
+        self.laid_out = true;
+        self.unsized_glyphs.take();
+        *self.draw_cache.get_mut() = None;
+
+        let wrap_width = if self.options.wrap_lines {
+            max_size.x
+        } else {
+            f32::INFINITY
+        };
+        let mut glyphs = mem::take(&mut self.glyphs);
+        self.size = resize::Layouter::new(self, cx).run_layout(&mut glyphs, wrap_width, max_size);
+        self.glyphs = glyphs;
+    }
 
-        let engine = resize::Layouter::new(self, cx);
-        engine.run_layout();
+    /// Gets the positioned glyphs. If the blob has not been resized,
+    /// they are laid out at the max content size on first use.
+    pub(crate) fn glyphs(&self, cx: &Context) -> &[ShapedGlyph] {
+        if self.laid_out {
+            return &self.glyphs;
+        }
+        self.unsized_glyphs.get_or_init(|| {
+            let mut glyphs = self.glyphs.clone();
+            resize::Layouter::new(self, cx).run_layout(
+                &mut glyphs,
+                f32::INFINITY,
+                self.max_content_size,
+            );
+            glyphs
+        })
     }
 
-    pub(crate) fn glyphs(&self) -> &[ShapedGlyph] {
-        &self.glyphs
+    pub(crate) fn draw_cache(&self) -> MutexGuard<Option<TextDrawCache>> {
+        self.draw_cache.lock()
     }
 
+    /// Gets the size of the laid out text, which is the
+    /// max content size if the blob has not been resized.
     pub fn size(&self) -> Vec2 {
-        self.size
+        if self.laid_out {
+            self.size
+        } else {
+            self.max_content_size
+        }
     }
 
     fn should_resize_for(&self, max_size: Vec2) -> bool {
         (max_size.x - self.max_size.x).abs() > 0.1 || (max_size.y - self.max_size.y).abs() > 0.1
     }
 
+    /// Gets the size of the text when wrapped as much as possible.
     pub fn min_content_size(&self) -> Vec2 {
         self.min_content_size
     }
 
+    /// Gets the size of the text without wrapping.
     pub fn max_content_size(&self) -> Vec2 {
         self.max_content_size
     }
+
+    /// Computes the size the text would have if resized to
+    /// `max_width`, without positioning any glyphs.
+    ///
+    /// Meant for layout engines that try several widths before
+    /// choosing one. Results for recent widths are remembered.
+    pub fn measure(&self, max_width: f32) -> Vec2 {
+        let max_width = if self.options.wrap_lines {
+            max_width
+        } else {
+            f32::INFINITY
+        };
+
+        let mut measurements = self.measurements.lock();
+        let key = max_width.to_bits();
+        if let Some(i) = measurements.iter().position(|&(width, _)| width == key) {
+            let measurement = measurements.remove(i);
+            measurements.insert(0, measurement);
+            return measurement.1;
+        }
+
+        let mut size = Vec2::ZERO;
+        for line in self.breaks.lines(max_width) {
+            size.x = size.x.max(line.width);
+            size.y += self.breaks.line_height(line.range);
+        }
+
+        if measurements.len() == MEASUREMENT_MEMO_LEN {
+            measurements.pop();
+        }
+        measurements.insert(0, (key, size));
+        size
+    }
+
+    /// Computes the height of the text wrapped to `width`. See [`measure`](Self::measure).
+    pub fn height_for_width(&self, width: f32) -> f32 {
+        self.measure(width).y
+    }
+}
+
+/// The fonts available to a text section.
+struct RunFonts<'a> {
+    fonts: &'a Fonts,
+    primary: FontId,
+    fallbacks: &'a [FontId],
+}
+
+impl RunFonts<'_> {
+    /// Splits `text` into runs that can each be drawn with one font.
+    ///
+    /// Characters use the primary font if it has them, or else the first
+    /// fallback font that does. Whitespace and characters that extend
+    /// a grapheme cluster (combining marks, variation selectors, joiners)
+    /// stay in the current run, as does the character following a zero-width
+    /// joiner. Characters no font has are left to the primary font's `.notdef`.
+    fn split(&self, text: &str) -> SmallVec<[(FontId, Range<usize>); 1]> {
+        let mut runs = SmallVec::new();
+        if self.fallbacks.is_empty() {
+            runs.push((self.primary, 0..text.len()));
+            return runs;
+        }
+
+        let mut current = self.primary;
+        let mut start = 0;
+        let mut after_joiner = false;
+        for (i, c) in text.char_indices() {
+            let font = if c.is_whitespace() || extends_cluster(c) || after_joiner {
+                current
+            } else if self.fonts.has_char(self.primary, c) {
+                self.primary
+            } else {
+                self.fallbacks
+                    .iter()
+                    .copied()
+                    .find(|&font| self.fonts.has_char(font, c))
+                    .unwrap_or(self.primary)
+            };
+            after_joiner = c == ZERO_WIDTH_JOINER;
+            if font != current {
+                if i > start {
+                    runs.push((current, start..i));
+                }
+                current = font;
+                start = i;
+            }
+        }
+        runs.push((current, start..text.len()));
+        runs
+    }
+}
+
+const ZERO_WIDTH_JOINER: char = '\u{200D}';
+
+/// Whether `c` belongs to the grapheme cluster of the preceding character,
+/// and so must be drawn with the same font.
+fn extends_cluster(c: char) -> bool {
+    // Emoji skin tone modifiers are symbols, not marks.
+    matches!(c, '\u{1F3FB}'..='\u{1F3FF}')
+        || matches!(
+            c.general_category(),
+            GeneralCategory::NonspacingMark
+                | GeneralCategory::SpacingMark
+                | GeneralCategory::EnclosingMark
+                // Joiners, tag characters, and other default-ignorables.
+                | GeneralCategory::Format
+        )
 }
 
 fn level_runs(levels: &[Level]) -> Vec<Range<usize>> {
@@ -367,7 +578,7 @@ fn script_runs(infos: &[CharInfo]) -> Vec<(Script, Range<usize>)> {
 }
 
 /// A glyph in a text blob, ready for rendering or layout.
-#[derive(Debug)]
+#[derive(Clone, Debug)]
 pub struct ShapedGlyph {
     /// Position of the glyph relative to the text blob origin
     pub pos: Vec2,
@@ -391,13 +602,58 @@ pub enum GlyphCharacter {
     LineBreak,
 }
 
+/// Shapes a run of text with a single font, script, and direction.
+fn shape_run(
+    shape_ctx: &mut ShapeContext,
+    font: FontRef,
+    text: &str,
+    size: f32,
+    script: Script,
+    bidi_level: &Level,
+) -> Arc<[ShapedRunGlyph]> {
+    let dir = if bidi_level.is_ltr() {
+        Direction::LeftToRight
+    } else {
+        Direction::RightToLeft
+    };
+
+    let mut shaper = shape_ctx
+        .builder(font)
+        .script(script)
+        .direction(dir)
+        .size(size)
+        .build();
+
+    shaper.add_str(text);
+
+    let mut glyphs = Vec::new();
+    shaper.shape_with(|cluster| {
+        for glyph in cluster.glyphs {
+            glyphs.push(ShapedRunGlyph {
+                id: glyph.id,
+                cluster: cluster.source.start,
+                offset: vec2(glyph.x, glyph.y),
+                advance: glyph.advance,
+                c: (&text[cluster.source.start as usize..])
+                    .chars()
+                    .next()
+                    .unwrap(),
+            });
+        }
+    });
+    glyphs.into()
+}
+
 /// A run within a [`Blob`] that has the same
 /// BiDi level, script, and style.
 #[derive(Debug)]
 pub(crate) enum BlobRun {
     Text {
+        /// Byte index of the run's text in the whole blob
+        start: usize,
         text: SmartString<LazyCompact>,
         style: TextStyle,
+        font: FontId,
         bidi_level: Level,
         script: Script,
     },
@@ -413,6 +669,7 @@ pub(crate) enum BlobRun {
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::font::Query;
 
     #[test]
     fn test_level_runs() {
@@ -432,7 +689,10 @@ mod tests {
     #[test]
     fn test_script_runs() {
         let info: Vec<_> = swash::text::analyze("dر".chars())
-            .map(|(properties, _)| CharInfo { properties })
+            .map(|(properties, boundary)| CharInfo {
+                properties,
+                boundary,
+            })
             .collect();
 
         assert_eq!(
@@ -440,4 +700,131 @@ mod tests {
             vec![(Script::Latin, 0..1), (Script::Arabic, 1..2),]
         );
     }
+
+    fn test_font_ids(fonts: &Fonts) -> (FontId, FontId) {
+        let zen = fonts.query(&Query::default().family("Zen Antique Soft"));
+        let allison = fonts.query(&Query::default().family("Allison"));
+        (zen.unwrap(), allison.unwrap())
+    }
+
+    /// Splits `text` with Allison as the primary font, falling back to
+    /// Zen Antique Soft, which has the kana that Allison lacks.
+    fn split_runs(text: &str) -> Vec<(FontId, Range<usize>)> {
+        let fonts = crate::font::test_fonts();
+        let (zen, allison) = test_font_ids(&fonts);
+        assert!(!fonts.has_char(allison, 'あ'));
+        assert!(fonts.has_char(zen, 'あ'));
+        RunFonts {
+            fonts: &fonts,
+            primary: allison,
+            fallbacks: &[zen],
+        }
+        .split(text)
+        .into_vec()
+    }
+
+    #[test]
+    fn test_split_keeps_clusters_together() {
+        let (zen, allison) = test_font_ids(&crate::font::test_fonts());
+
+        // A combining acute accent and a voiced sound mark stay with their base.
+        assert_eq!(
+            split_runs("e\u{301}あ\u{3099}\u{301}"),
+            vec![(allison, 0..3), (zen, 3..11)]
+        );
+
+        // A variation selector, a joiner, and the joined character
+        // stay with the character that starts the sequence.
+        assert_eq!(
+            split_runs("あ\u{FE0F}\u{200D}e a"),
+            vec![(zen, 0..11), (allison, 11..12)]
+        );
+    }
+
+    /// Builds line breaks for `text` with one glyph per character, each
+    /// one unit wide. Lines may wrap before a word that follows spaces.
+    fn line_breaks(text: &str, sizes: impl Fn(usize) -> f32) -> LineBreaks {
+        let chars: Vec<char> = text.chars().collect();
+        let glyphs: Vec<ShapedGlyph> = chars
+            .iter()
+            .enumerate()
+            .map(|(i, &c)| ShapedGlyph {
+                pos: Vec2::ZERO,
+                offset: Vec2::ZERO,
+                advance: if c == '\n' { 0. } else { 1. },
+                c: if c == '\n' {
+                    GlyphCharacter::LineBreak
+                } else {
+                    GlyphCharacter::Glyph(0, sizes(i), c)
+                },
+                font: FontId::default(),
+                size: sizes(i),
+                color: Default::default(),
+            })
+            .collect();
+        let break_before: Vec<bool> = (0..chars.len())
+            .map(|i| i > 0 && chars[i - 1] == ' ' && chars[i] != ' ')
+            .collect();
+        LineBreaks::new(&glyphs, &break_before, &crate::font::test_fonts())
+    }
+
+    fn lines(breaks: &LineBreaks, max_width: f32) -> Vec<(Range<usize>, f32)> {
+        breaks
+            .lines(max_width)
+            .map(|line| (line.range, line.width))
+            .collect()
+    }
+
+    #[test]
+    fn test_mandatory_breaks() {
+        let breaks = line_breaks("ab\ncd e", |_| 12.);
+        assert_eq!(lines(&breaks, f32::INFINITY), vec![(0..2, 2.), (2..7, 4.)]);
+        assert_eq!(lines(&breaks, 3.), vec![(0..2, 2.), (2..6, 2.), (6..7, 1.)]);
+        assert_eq!(breaks.min_width(), 2.);
+        assert_eq!(breaks.max_width(), 4.);
+    }
+
+    #[test]
+    fn test_hanging_whitespace() {
+        let breaks = line_breaks("ab   cd", |_| 12.);
+        // The spaces hang past the end of the first line.
+        assert_eq!(lines(&breaks, 2.), vec![(0..5, 2.), (5..7, 2.)]);
+        assert_eq!(lines(&breaks, 7.), vec![(0..7, 7.)]);
+        assert_eq!(breaks.min_width(), 2.);
+    }
+
+    #[test]
+    fn test_in_word_fallback() {
+        let breaks = line_breaks("abcde fg", |_| 12.);
+        // A word wider than the line wraps after as many glyphs as fit.
+        assert_eq!(
+            lines(&breaks, 2.5),
+            vec![(0..2, 2.), (2..4, 2.), (4..6, 1.), (6..8, 2.)]
+        );
+        // At least one glyph goes on each line.
+        assert_eq!(lines(&breaks, 0.5).len(), 8);
+        assert_eq!(breaks.min_width(), 5.);
+    }
+
+    #[test]
+    fn test_line_heights() {
+        let sizes = [3., 1., 4., 1., 5., 9., 2., 6., 5., 3., 5.];
+        let text = "a".repeat(sizes.len());
+        let breaks = line_breaks(&text, |i| sizes[i]);
+
+        let glyph_heights: Vec<f32> = (0..sizes.len())
+            .map(|i| breaks.line_height(i..i + 1))
+            .collect();
+        for (height, size) in glyph_heights.iter().zip(sizes) {
+            assert!((height / size - glyph_heights[0] / sizes[0]).abs() < 1e-4);
+        }
+
+        for start in 0..sizes.len() {
+            for end in start + 1..=sizes.len() {
+                let expected = glyph_heights[start..end].iter().copied().fold(0., f32::max);
+                assert_eq!(breaks.line_height(start..end), expected, "{:?}", start..end);
+            }
+        }
+        assert_eq!(breaks.line_height(3..3), 0.);
+    }
 }
@@ -0,0 +1,222 @@
+use std::{
+    hash::{BuildHasher, Hash, Hasher},
+    sync::Arc,
+};
+
+use ahash::{AHashMap, RandomState};
+use glam::Vec2;
+use palette::Srgba;
+
+use crate::{text::TextStyle, Text, TextSection};
+
+use super::{TextBlob, TextOptions};
+
+/// Identifies a blob drawn through [`Canvas::draw_str`](crate::Canvas::draw_str).
+///
+/// The key borrows the text, so that looking up a cached blob does
+/// not clone it. Floats are compared by their bits, which keeps
+/// hashing consistent with equality for `-0.0` and NaN.
+#[derive(Copy, Clone, Debug)]
+pub struct BlobKey<'a> {
+    text: &'a Text,
+    options: &'a TextOptions,
+    max_size: Vec2,
+}
+
+impl<'a> BlobKey<'a> {
+    pub fn new(text: &'a Text, options: &'a TextOptions, max_size: Vec2) -> Self {
+        Self {
+            text,
+            options,
+            max_size,
+        }
+    }
+
+    fn hash(&self, hasher: &RandomState) -> u64 {
+        let mut state = hasher.build_hasher();
+        hash_text(self.text, &mut state);
+        self.options.hash(&mut state);
+        hash_vec2(self.max_size, &mut state);
+        state.finish()
+    }
+
+    fn matches(&self, cached: &CachedBlob) -> bool {
+        text_eq(self.text, &cached.text)
+            && *self.options == cached.options
+            && vec2_eq(self.max_size, cached.max_size)
+    }
+}
+
+struct CachedBlob {
+    text: Text,
+    options: TextOptions,
+    max_size: Vec2,
+    blob: Arc<TextBlob>,
+    last_used_frame: u64,
+}
+
+/// Text blobs created for immediate-mode text drawing.
+///
+/// A blob is kept as long as it is drawn at least once every
+/// `expire_frames` frames, as counted by `Context::end_frame`.
+pub struct BlobCache {
+    /// Blobs keyed by the hash of their [`BlobKey`].
+    /// Blobs with colliding hashes share a bucket.
+    blobs: AHashMap<u64, Vec<CachedBlob>>,
+    hasher: RandomState,
+    frame: u64,
+    expire_frames: u64,
+}
+
+impl BlobCache {
+    pub fn new(expire_frames: u32) -> Self {
+        Self {
+            blobs: AHashMap::new(),
+            hasher: RandomState::new(),
+            frame: 0,
+            expire_frames: expire_frames.into(),
+        }
+    }
+
+    pub fn get(&mut self, key: &BlobKey) -> Option<Arc<TextBlob>> {
+        let bucket = self.blobs.get_mut(&key.hash(&self.hasher))?;
+        let cached = bucket.iter_mut().find(|cached| key.matches(cached))?;
+        cached.last_used_frame = self.frame;
+        Some(Arc::clone(&cached.blob))
+    }
+
+    /// Inserts a blob, cloning the key's text. Replaces any blob
+    /// cached under an equal key.
+    pub fn insert(&mut self, key: &BlobKey, blob: Arc<TextBlob>) {
+        let cached = CachedBlob {
+            text: key.text.clone(),
+            options: key.options.clone(),
+            max_size: key.max_size,
+            blob,
+            last_used_frame: self.frame,
+        };
+        let bucket = self.blobs.entry(key.hash(&self.hasher)).or_default();
+        match bucket.iter_mut().find(|existing| key.matches(existing)) {
+            Some(existing) => *existing = cached,
+            None => bucket.push(cached),
+        }
+    }
+
+    /// Drops blobs that were not drawn in the last `expire_frames` frames.
+    pub fn end_frame(&mut self) {
+        let frame = self.frame;
+        let expire_frames = self.expire_frames;
+        self.blobs.retain(|_, bucket| {
+            bucket.retain(|cached| frame - cached.last_used_frame < expire_frames);
+            !bucket.is_empty()
+        });
+        self.frame += 1;
+    }
+}
+
+fn hash_text<H: Hasher>(text: &Text, state: &mut H) {
+    text.sections.len().hash(state);
+    for section in &text.sections {
+        match section {
+            TextSection::Text { text, style } => {
+                0u8.hash(state);
+                text.hash(state);
+                hash_style(style, state);
+            }
+            TextSection::Icon { name, size } => {
+                1u8.hash(state);
+                name.hash(state);
+                size.to_bits().hash(state);
+            }
+        }
+    }
+    text.default_size.to_bits().hash(state);
+    hash_color(text.default_color, state);
+    text.default_font_family.hash(state);
+}
+
+fn hash_style<H: Hasher>(style: &TextStyle, state: &mut H) {
+    style.color.map(color_bytes).hash(state);
+    style.size.map(f32::to_bits).hash(state);
+    style.font.hash(state);
+}
+
+fn hash_color<H: Hasher>(color: Srgba<u8>, state: &mut H) {
+    color_bytes(color).hash(state);
+}
+
+fn hash_vec2<H: Hasher>(v: Vec2, state: &mut H) {
+    [v.x.to_bits(), v.y.to_bits()].hash(state);
+}
+
+fn text_eq(a: &Text, b: &Text) -> bool {
+    a.sections.len() == b.sections.len()
+        && a.sections
+            .iter()
+            .zip(&b.sections)
+            .all(|(a, b)| section_eq(a, b))
+        && a.default_size.to_bits() == b.default_size.to_bits()
+        && color_bytes(a.default_color) == color_bytes(b.default_color)
+        && a.default_font_family == b.default_font_family
+}
+
+fn section_eq(a: &TextSection, b: &TextSection) -> bool {
+    match (a, b) {
+        (
+            TextSection::Text { text, style },
+            TextSection::Text {
+                text: text_b,
+                style: style_b,
+            },
+        ) => text == text_b && style_eq(style, style_b),
+        (
+            TextSection::Icon { name, size },
+            TextSection::Icon {
+                name: name_b,
+                size: size_b,
+            },
+        ) => name == name_b && size.to_bits() == size_b.to_bits(),
+        _ => false,
+    }
+}
+
+fn style_eq(a: &TextStyle, b: &TextStyle) -> bool {
+    a.color.map(color_bytes) == b.color.map(color_bytes)
+        && a.size.map(f32::to_bits) == b.size.map(f32::to_bits)
+        && a.font == b.font
+}
+
+fn vec2_eq(a: Vec2, b: Vec2) -> bool {
+    a.x.to_bits() == b.x.to_bits() && a.y.to_bits() == b.y.to_bits()
+}
+
+fn color_bytes(color: Srgba<u8>) -> [u8; 4] {
+    [color.red, color.green, color.blue, color.alpha]
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_blob_key_compares_float_bits() {
+        let hasher = RandomState::new();
+        let options = TextOptions::default();
+        let mut a = Text::from("text");
+        a.set_default_size(0.);
+        let mut b = a.clone();
+        b.set_default_size(-0.);
+
+        let key_a = BlobKey::new(&a, &options, Vec2::ZERO);
+        let key_b = BlobKey::new(&b, &options, Vec2::ZERO);
+        assert_ne!(key_a.hash(&hasher), key_b.hash(&hasher));
+        assert!(!text_eq(&a, &b));
+
+        let mut nan = a.clone();
+        nan.set_default_size(f32::NAN);
+        let key_nan = BlobKey::new(&nan, &options, Vec2::splat(f32::NAN));
+        assert_eq!(key_nan.hash(&hasher), key_nan.hash(&hasher));
+        assert!(text_eq(&nan, &nan.clone()));
+        assert!(vec2_eq(key_nan.max_size, key_nan.max_size));
+    }
+}
@@ -0,0 +1,170 @@
+use std::ops::Range;
+
+use crate::font::Fonts;
+
+use super::{GlyphCharacter, ShapedGlyph};
+
+/// A line chosen by [`LineBreaks::lines`].
+#[derive(Clone, Debug)]
+pub struct Line {
+    pub range: Range<usize>,
+    /// Width of the line, excluding trailing whitespace.
+    pub width: f32,
+}
+
+/// Line break opportunities and cumulative advances of a blob's glyphs.
+///
+/// Computed once after shaping, so that wrapping the blob to a
+/// width takes a few binary searches per line rather than a pass
+/// over every glyph.
+#[derive(Default)]
+pub struct LineBreaks {
+    /// `advances[i]` is the total advance of glyphs `..i`.
+    advances: Vec<f32>,
+    /// Like `advances`, but excluding whitespace at the end of `..i`,
+    /// which is allowed to hang past the end of a line.
+    trimmed: Vec<f32>,
+    /// Glyphs before which a line may wrap, in order.
+    opportunities: Vec<usize>,
+    /// Glyphs that always start a new line, in order.
+    mandatory: Vec<usize>,
+    /// Sparse table of the height glyphs contribute to their line:
+    /// `heights[k][i]` is the maximum over glyphs `i..i + 2^k`.
+    heights: Vec<Vec<f32>>,
+
+    /// Width of the widest span of glyphs that cannot be wrapped.
+    min_width: f32,
+    /// Width of the widest line if no line is wrapped.
+    max_width: f32,
+}
+
+impl LineBreaks {
+    /// `break_before[i]` tells whether a line may wrap before glyph `i`.
+    pub fn new(glyphs: &[ShapedGlyph], break_before: &[bool], fonts: &Fonts) -> Self {
+        let mut breaks = Self {
+            advances: Vec::with_capacity(glyphs.len() + 1),
+            trimmed: Vec::with_capacity(glyphs.len() + 1),
+            ..Default::default()
+        };
+        let mut line_heights = Vec::with_capacity(glyphs.len());
+
+        let mut advance = 0.;
+        let mut trimmed = 0.;
+        breaks.advances.push(advance);
+        breaks.trimmed.push(trimmed);
+        let mut segment_start = 0;
+        let mut line_start = 0;
+        for (i, glyph) in glyphs.iter().enumerate() {
+            let mandatory = matches!(glyph.c, GlyphCharacter::LineBreak);
+            if mandatory || (break_before[i] && i > 0) {
+                breaks.min_width = breaks.min_width.max(breaks.width(segment_start, i));
+                segment_start = i;
+                if mandatory {
+                    breaks.max_width = breaks.max_width.max(breaks.width(line_start, i));
+                    line_start = i;
+                    breaks.mandatory.push(i);
+                } else {
+                    breaks.opportunities.push(i);
+                }
+            }
+
+            advance += glyph.advance;
+            if !matches!(glyph.c, GlyphCharacter::Glyph(_, _, c) if c.is_whitespace()) {
+                trimmed = advance;
+            }
+            breaks.advances.push(advance);
+            breaks.trimmed.push(trimmed);
+
+            let metrics = fonts.metrics(glyph.font);
+            let font_scale = glyph.size / metrics.units_per_em as f32;
+            line_heights.push(font_scale * (metrics.ascent + metrics.descent + metrics.leading));
+        }
+        breaks.min_width = breaks
+            .min_width
+            .max(breaks.width(segment_start, glyphs.len()));
+        breaks.max_width = breaks.max_width.max(breaks.width(line_start, glyphs.len()));
+
+        breaks.heights.push(line_heights);
+        let mut span = 1;
+        while span * 2 <= glyphs.len() {
+            let previous = breaks.heights.last().unwrap();
+            let level = (0..=glyphs.len() - span * 2)
+                .map(|i| previous[i].max(previous[i + span]))
+                .collect();
+            breaks.heights.push(level);
+            span *= 2;
+        }
+
+        breaks
+    }
+
+    fn len(&self) -> usize {
+        self.advances.len().saturating_sub(1)
+    }
+
+    /// Width of glyphs `start..end`, excluding trailing whitespace.
+    fn width(&self, start: usize, end: usize) -> f32 {
+        (self.trimmed[end] - self.advances[start]).max(0.)
+    }
+
+    pub fn min_width(&self) -> f32 {
+        self.min_width
+    }
+
+    pub fn max_width(&self) -> f32 {
+        self.max_width
+    }
+
+    /// Gets the height of the line containing `range`.
+    pub fn line_height(&self, range: Range<usize>) -> f32 {
+        if range.is_empty() {
+            return 0.;
+        }
+        let level = (usize::BITS - 1 - range.len().leading_zeros()) as usize;
+        let heights = &self.heights[level];
+        heights[range.start].max(heights[range.end - (1 << level)])
+    }
+
+    /// Wraps the glyphs into lines no wider than `max_width`
+    /// where possible. There is always at least one line.
+    pub fn lines(&self, max_width: f32) -> impl Iterator<Item = Line> + '_ {
+        let mut start = Some(0);
+        std::iter::from_fn(move || {
+            let line = self.line_at(start?, max_width);
+            start = (line.range.end < self.len()).then(|| line.range.end);
+            Some(line)
+        })
+    }
+
+    /// Finds the line starting at glyph `start`.
+    fn line_at(&self, start: usize, max_width: f32) -> Line {
+        let mandatory = self.mandatory.partition_point(|&glyph| glyph <= start);
+        let limit = self.mandatory.get(mandatory).copied().unwrap_or(self.len());
+
+        let base = self.advances[start];
+        if limit == start || self.trimmed[limit] - base <= max_width {
+            return self.line(start, limit);
+        }
+
+        // Wrap at the last opportunity before `limit` that fits.
+        let first = self.opportunities.partition_point(|&glyph| glyph <= start);
+        let last = self.opportunities.partition_point(|&glyph| glyph < limit);
+        let candidates = &self.opportunities[first..last];
+        let fitting = candidates.partition_point(|&glyph| self.trimmed[glyph] - base <= max_width);
+        if fitting > 0 {
+            return self.line(start, candidates[fitting - 1]);
+        }
+
+        // No opportunity fits, so wrap within the word after as many glyphs
+        // as fit, keeping at least one glyph on the line.
+        let fitting = self.advances[start + 1..=limit].partition_point(|&a| a - base <= max_width);
+        self.line(start, start + fitting.max(1))
+    }
+
+    fn line(&self, start: usize, end: usize) -> Line {
+        Line {
+            range: start..end,
+            width: self.width(start, end),
+        }
+    }
+}
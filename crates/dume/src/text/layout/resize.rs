@@ -1,171 +1,83 @@
-use std::ops::Range;
-
-use ahash::AHashSet;
-use glam::Vec2;
+use glam::{vec2, Vec2};
 use parking_lot::RwLockReadGuard;
 
-use crate::{font::Fonts, text::layout::GlyphCharacter, Align, Baseline, Context, TextBlob};
-
-#[derive(Default, Clone)]
-struct Line {
-    next_line_offset: f32,
-    num_glyphs: usize,
-    range: Range<usize>,
-    width: f32,
-}
+use crate::{
+    font::Fonts,
+    text::layout::{line_break::Line, ShapedGlyph},
+    Align, Baseline, Context, TextBlob, TextOptions,
+};
 
-/// Does line wrapping on a list of `ShapedGlyph`.
+/// Positions the glyphs of a `TextBlob`, wrapping them
+/// into lines using the blob's precomputed line breaks.
 pub struct Layouter<'a> {
-    blob: &'a mut TextBlob,
+    blob: &'a TextBlob,
     fonts: RwLockReadGuard<'a, Fonts>,
-
-    cursor: Vec2,
-
-    current_line: Line,
-    lines: Vec<Line>,
-
-    next_glyph: usize,
-
-    used_line_breaks: AHashSet<u32>,
-    previous_word_break: Option<usize>,
 }
 
 impl<'a> Layouter<'a> {
-    pub fn new(blob: &'a mut TextBlob, cx: &'a Context) -> Self {
-        blob.size = Vec2::ZERO;
+    pub fn new(blob: &'a TextBlob, cx: &'a Context) -> Self {
         Self {
             blob,
             fonts: cx.fonts(),
-
-            cursor: Vec2::ZERO,
-
-            current_line: Line::default(),
-            lines: Vec::new(),
-
-            next_glyph: 0,
-
-            used_line_breaks: AHashSet::new(),
-            previous_word_break: None,
         }
     }
 
-    fn next_line(&mut self) {
-        self.current_line.range.end = self.next_glyph;
-        self.lines.push(self.current_line.clone());
-
-        self.blob.size.x = self.blob.size.x.max(self.cursor.x);
-        self.cursor.x = 0.;
-        self.cursor.y += self.current_line.next_line_offset;
-        self.blob.size.y += self.current_line.next_line_offset;
-        self.current_line.num_glyphs = 0;
-        self.current_line.range.start = self.next_glyph;
-        self.current_line.width = 0.;
-    }
-
-    fn process_next_glyph(&mut self) {
-        if matches!(
-            &self.blob.glyphs[self.next_glyph].c,
-            GlyphCharacter::LineBreak
-        ) {
-            self.next_line();
-        }
-
-        let glyph = &mut self.blob.glyphs[self.next_glyph];
-
-        // Apply the line offset for this line
-        let font = self.fonts.get(glyph.font);
-        let metrics = font.metrics(&[]);
-        let font_scale = glyph.size / metrics.units_per_em as f32;
-        let line_offset = font_scale * (metrics.ascent + metrics.descent + metrics.leading);
-        self.current_line.next_line_offset = self.current_line.next_line_offset.max(line_offset);
-
-        glyph.pos = self.cursor;
-
-        // Account for the baseline setting
-        let baseline_offset = match self.blob.options.baseline {
-            Baseline::Top => metrics.ascent,
-            Baseline::Middle => (metrics.ascent + metrics.descent) / 2.,
-            Baseline::Alphabetic => 0.,
-            Baseline::Bottom => metrics.descent,
-        };
-        glyph.pos.y += baseline_offset * font_scale;
-
-        self.cursor.x += glyph.advance;
-        self.current_line.width += glyph.advance;
-        self.blob.max_content_size.x += glyph.advance;
-
-        if let GlyphCharacter::Glyph(_, _, c) = &glyph.c {
-            if *c == ' '
-                && !self
-                    .used_line_breaks
-                    .contains(&(self.next_glyph as u32 + 1))
-            {
-                // Count length of this word to help determine min_content_size.x
-                let previous = self.previous_word_break.unwrap_or(0);
-                let word_length: f32 = self.blob.glyphs[previous..self.next_glyph]
-                    .iter()
-                    .map(|g| g.advance)
-                    .sum();
-                self.blob.min_content_size.x = self.blob.min_content_size.x.max(word_length);
-
-                self.previous_word_break = Some(self.next_glyph + 1);
-                self.blob.max_content_size.y += self.current_line.next_line_offset;
-            }
-        }
-
-        if self.cursor.x > self.blob.max_size.x
-            && self.current_line.num_glyphs > 0
-            && self.blob.options.wrap_lines
-        {
-            // We need to wrap to the next line.
-            //
-            // If there is an available word boundary, we move back
-            // to the boundary before wrapping.
-            if let Some(boundary) = self.previous_word_break.take() {
-                if self.used_line_breaks.insert(boundary as u32) {
-                    self.next_glyph = boundary;
-                }
+    /// Positions `glyphs`, which are the blob's shaped glyphs, wrapping lines
+    /// at `wrap_width` and aligning them within `max_size`.
+    ///
+    /// Returns the size of the laid out text.
+    pub fn run_layout(self, glyphs: &mut [ShapedGlyph], wrap_width: f32, max_size: Vec2) -> Vec2 {
+        let blob = self.blob;
+        let lines: Vec<Line> = blob.breaks.lines(wrap_width).collect();
+
+        let mut size = Vec2::ZERO;
+        for line in &lines {
+            let mut cursor_x = 0.;
+            for glyph in &mut glyphs[line.range.clone()] {
+                let metrics = self.fonts.metrics(glyph.font);
+                let font_scale = glyph.size / metrics.units_per_em as f32;
+
+                // Account for the baseline setting
+                let baseline_offset = match blob.options.baseline {
+                    Baseline::Top => metrics.ascent,
+                    Baseline::Middle => (metrics.ascent + metrics.descent) / 2.,
+                    Baseline::Alphabetic => 0.,
+                    Baseline::Bottom => metrics.descent,
+                };
+
+                glyph.pos = vec2(cursor_x, size.y + baseline_offset * font_scale);
+                cursor_x += glyph.advance;
             }
 
-            self.next_line();
-        } else {
-            self.next_glyph += 1;
-            self.current_line.num_glyphs += 1;
+            size.x = size.x.max(line.width);
+            size.y += blob.breaks.line_height(line.range.clone());
         }
-    }
 
-    pub fn run_layout(mut self) {
-        self.blob.min_content_size = Vec2::ZERO;
-        self.blob.max_content_size = Vec2::ZERO;
-        while self.next_glyph < self.blob.glyphs.len() {
-            self.process_next_glyph();
-        }
-
-        self.next_line();
-        self.apply_align();
-
-        self.blob.min_content_size.y = self.current_line.next_line_offset;
+        apply_align(&blob.options, glyphs, &lines, size, max_size);
+        size
     }
+}
 
-    fn apply_align(&mut self) {
-        // Apply horizontal alignment.
-        for line in &self.lines {
-            let line_width = line.width;
-            let relative_pos =
-                relative_align_pos(self.blob.options.align_h, line_width, self.blob.max_size.x);
-
-            for glyph in &mut self.blob.glyphs[line.range.clone()] {
-                glyph.pos.x += relative_pos;
-            }
+fn apply_align(
+    options: &TextOptions,
+    glyphs: &mut [ShapedGlyph],
+    lines: &[Line],
+    size: Vec2,
+    max_size: Vec2,
+) {
+    // Apply horizontal alignment.
+    for line in lines {
+        let relative_pos = relative_align_pos(options.align_h, line.width, max_size.x);
+
+        for glyph in &mut glyphs[line.range.clone()] {
+            glyph.pos.x += relative_pos;
         }
+    }
 
-        // Apply vertical alignment.
-        let height = self.blob.size().y;
-        let relative_pos =
-            relative_align_pos(self.blob.options.align_v, height, self.blob.max_size.y);
-        for glyph in &mut self.blob.glyphs {
-            glyph.pos.y += relative_pos;
-        }
+    // Apply vertical alignment.
+    let relative_pos = relative_align_pos(options.align_v, size.y, max_size.y);
+    for glyph in glyphs {
+        glyph.pos.y += relative_pos;
     }
 }
 
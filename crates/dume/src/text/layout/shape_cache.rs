@@ -0,0 +1,141 @@
+use std::sync::Arc;
+
+use glam::Vec2;
+use lru::LruCache;
+use smartstring::{LazyCompact, SmartString};
+use swash::{text::Script, GlyphId};
+
+use crate::FontId;
+
+/// Identifies a run of text shaped with a single font and direction.
+#[derive(Clone, Debug, PartialEq, Eq, Hash)]
+pub struct ShapeKey {
+    text: SmartString<LazyCompact>,
+    font: FontId,
+    size: u32, // f32 bits
+    script: u32,
+    rtl: bool,
+}
+
+impl ShapeKey {
+    pub fn new(
+        text: &SmartString<LazyCompact>,
+        font: FontId,
+        size: f32,
+        script: Script,
+        rtl: bool,
+    ) -> Self {
+        Self {
+            text: text.clone(),
+            font,
+            size: size.to_bits(),
+            script: script as u32,
+            rtl,
+        }
+    }
+}
+
+/// A glyph output by the shaper, before layout.
+#[derive(Copy, Clone, Debug)]
+pub struct ShapedRunGlyph {
+    pub id: GlyphId,
+    /// Byte index of the glyph's cluster in the run
+    pub cluster: u32,
+    pub offset: Vec2,
+    pub advance: f32,
+    /// First character of the glyph's cluster
+    pub c: char,
+}
+
+/// Counters for the shaping cache. See [`Context::shape_cache_stats`](crate::Context::shape_cache_stats).
+#[derive(Copy, Clone, Debug, Default)]
+pub struct ShapeCacheStats {
+    /// Number of runs whose shaping was reused.
+    pub hits: u64,
+    /// Number of runs that had to be shaped.
+    pub misses: u64,
+    /// Number of runs currently cached.
+    pub len: usize,
+}
+
+/// An LRU cache of shaped text runs shared by all text blobs,
+/// so that blobs recreated for the same strings skip shaping.
+pub struct ShapeCache {
+    runs: LruCache<ShapeKey, Arc<[ShapedRunGlyph]>>,
+    hits: u64,
+    misses: u64,
+}
+
+impl ShapeCache {
+    pub fn new(capacity: usize) -> Self {
+        Self {
+            runs: LruCache::new(capacity),
+            hits: 0,
+            misses: 0,
+        }
+    }
+
+    pub fn get(&mut self, key: &ShapeKey) -> Option<Arc<[ShapedRunGlyph]>> {
+        match self.runs.get(key) {
+            Some(glyphs) => {
+                self.hits += 1;
+                Some(Arc::clone(glyphs))
+            }
+            None => {
+                self.misses += 1;
+                None
+            }
+        }
+    }
+
+    pub fn insert(&mut self, key: ShapeKey, glyphs: Arc<[ShapedRunGlyph]>) {
+        self.runs.put(key, glyphs);
+    }
+
+    pub fn stats(&self) -> ShapeCacheStats {
+        ShapeCacheStats {
+            hits: self.hits,
+            misses: self.misses,
+            len: self.runs.len(),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn key(text: &str, size: f32) -> ShapeKey {
+        ShapeKey::new(&text.into(), FontId::default(), size, Script::Latin, false)
+    }
+
+    fn glyphs(count: usize) -> Arc<[ShapedRunGlyph]> {
+        let glyph = ShapedRunGlyph {
+            id: 0,
+            cluster: 0,
+            offset: Vec2::ZERO,
+            advance: 1.,
+            c: 'a',
+        };
+        vec![glyph; count].into()
+    }
+
+    #[test]
+    fn test_shape_cache() {
+        let mut cache = ShapeCache::new(2);
+        assert!(cache.get(&key("a", 12.)).is_none());
+        cache.insert(key("a", 12.), glyphs(1));
+        cache.insert(key("bc", 12.), glyphs(2));
+        assert_eq!(cache.get(&key("a", 12.)).unwrap().len(), 1);
+        // Runs differ by size.
+        assert!(cache.get(&key("a", 14.)).is_none());
+
+        // "bc" is least recently used.
+        cache.insert(key("def", 12.), glyphs(3));
+        assert!(cache.get(&key("bc", 12.)).is_none());
+        assert!(cache.get(&key("a", 12.)).is_some());
+
+        let stats = cache.stats();
+        assert_eq!((stats.hits, stats.misses, stats.len), (2, 3, 2));
+    }
+}